@@ -5,9 +5,29 @@
 //
 //==============================================================================
 #include "xm.hpp"
+#include "xm_params.hpp"
+#include "xm_property.hpp"
+#include "xm_threads.hpp"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
 #include <chrono>
 #include <vector>
+#include <deque>
+#include <map>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <iterator>
 #include <cassert>
+#include <cmath>
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+#include <csignal>
 
 #ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
@@ -19,6 +39,19 @@
 #endif
 
 #include <Windows.h>
+#include <Psapi.h>
+#else
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <cerrno>
+#endif
+
+#if defined __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
 #endif
 
 namespace xm
@@ -26,42 +59,27 @@ namespace xm
 namespace
 {
 
-struct StreamBuf : std::streambuf
-{
-  StreamBuf(size_t size, char* buffer)
-  : mSize(size),
-    mBuffer(buffer)
-  {
-    setp(buffer, buffer + size);
-  }
-
-  void Reset()
-  {
-    setp(mBuffer, mBuffer + mSize);
-  }
-
-private:
-  size_t mSize;
-  char* mBuffer;
-};
-
 namespace sc = std::chrono;
 
-struct Clock
+///@return The current time of the steady clock, in nanoseconds.
+int64_t NowNs()
 {
-  Clock()
-  : mLast(sc::high_resolution_clock::now())
-  {}
+  return sc::duration_cast<sc::nanoseconds>(sc::steady_clock::now().time_since_epoch()).count();
+}
 
+// Measures wall time on the steady clock, in nanoseconds.
+struct Clock
+{
+  ///@return The milliseconds since the last measurement, or the construction of the clock.
   double Measure()
   {
-    auto last = sc::high_resolution_clock::now();
-    auto diff = sc::duration_cast<sc::duration<double, std::milli>>(last - mLast);
-    mLast = last;
-    return diff.count();
+    auto last = NowNs();
+    auto diff = last - mLastNs;
+    mLastNs = last;
+    return double(diff) * 1e-6;
   }
 
-  sc::high_resolution_clock::time_point mLast;
+  int64_t mLastNs = NowNs();
 };
 
 struct Exception
@@ -89,6 +107,25 @@ HANDLE sOutputHandle = GetStdHandle(STD_OUTPUT_HANDLE);
 #define FOREGROUND_RESET 0
 #endif
 
+///@brief Writes @a value in decimal to @a out.
+///@return The position past the last digit written.
+char* WriteDecimal(char* out, unsigned int value)
+{
+  char digits[10];
+  auto p = digits;
+  do
+  {
+    *p++ = char('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+
+  while (p != digits)
+  {
+    *out++ = *--p;
+  }
+  return out;
+}
+
 std::ostream& operator<<(std::ostream& stream, StreamColor color)
 {
 #ifdef _WIN32
@@ -97,21 +134,54 @@ std::ostream& operator<<(std::ostream& stream, StreamColor color)
     SetConsoleTextAttribute(sOutputHandle, color.attribute);
   }
 #else
-  char buffer[24];
-  snprintf(buffer, sizeof(buffer), "\033[%d;%dm", (color.attribute & 0xff00) >> 8,
-    (color.attribute & 0xff));
-  stream << buffer;
+  char buffer[16] = "\033[";
+  auto p = WriteDecimal(buffer + 2, (color.attribute & 0xff00) >> 8);
+  *p++ = ';';
+  p = WriteDecimal(p, color.attribute & 0xff);
+  *p++ = 'm';
+  stream.write(buffer, p - buffer);
 #endif
   return stream;
 }
 
+// The pairs of hex digits of every byte value.
+struct HexTable
+{
+  char digits[256][2];
+};
+
+constexpr HexTable kHexTable = [] {
+  constexpr char kDigits[] = "0123456789abcdef";
+  HexTable table{};
+  for (int i = 0; i < 256; ++i)
+  {
+    table.digits[i][0] = kDigits[i >> 4];
+    table.digits[i][1] = kDigits[i & 0xf];
+  }
+  return table;
+}();
+
+///@brief Writes @a size bytes to @a out in hex, each followed by a space.
+///@return The position past the last character written.
+char* EncodeHex(uint8_t const* bytes, size_t size, char* out)
+{
+  for (auto end = bytes + size; bytes != end; ++bytes)
+  {
+    memcpy(out, kHexTable.digits[*bytes], 2);
+    out[2] = ' ';
+    out += 3;
+  }
+  return out;
+}
+
 enum Status
 {
   FAILED,
   OK,
   STARTED,
   SUITE,
-  TALLY
+  TALLY,
+  BENCH
 };
 
 constexpr char const* const kStatus[]{
@@ -120,315 +190,5763 @@ constexpr char const* const kStatus[]{
   "STARTED   ",
   "==========",
   "----------",
+  "     BENCH",
 };
 
 constexpr char kFilterWildcard = '*';
 constexpr char kJoinTestSuiteName = '_';
 
-thread_local char sMessageBuffer[1024];
-
-thread_local StreamBuf sStreamBuf{ sizeof(sMessageBuffer), sMessageBuffer };
-
-std::string sIncludeFilter(1, kFilterWildcard);
-std::string sExcludeFilter;
-
-detail::Test* sFirst = nullptr;
-detail::Test* sLast = nullptr;
+size_t sMessageLimit = 1 << 20;
+size_t sMaxBytesPrinted = 64;
 
-char const* sError = nullptr;
-
-std::ostream* sOutput = &std::cout;
-
-///@brief Attempts to match the filter string in the [ @a filter, @a filterEnd ) range
-/// with the id in the [ @a id, @a idEnd ) range, handling wildcards.
-///@returns false on a mismatch, and true if we've made it to both the end of filter
-/// and id without a mismatch.
-bool FilterMatch(char const* filter, char const* filterEnd, char const* id, char const* idEnd)
+// A std::streambuf that formats messages one after the other into chunks of memory,
+// where they stay until Reset(). The first chunk is part of the object; further ones
+// are allocated once a message doesn't fit, each at least twice the size of the
+// last, until sMessageLimit is reached, from where messages are truncated. Chunks
+// are kept across Reset()s, so once warmed up, formatting doesn't allocate.
+class MessageArena : public std::streambuf
 {
-  // If we're at the end of the string, then we succeed if there's no non-wildcard characters
-  // left of the filter.
-  if (id == idEnd)
+public:
+  MessageArena()
   {
-    return std::find_if(filter, filterEnd, [](char c) { return c != kFilterWildcard; }) == filterEnd;
+    Reset();
   }
 
-  if (filter == filterEnd)  // filter finished, id didn't -- fail.
+  void Begin()
   {
-    return false;
+    mStart = pptr();
   }
 
-  if (*filter == *id) // next character matches -- proceed.
+  ///@brief Terminates the message started with Begin().
+  ///@return The message, which remains valid until Reset().
+  char const* End()
   {
-    return FilterMatch(filter + 1, filterEnd, id + 1, idEnd);
+    auto message = mStart;
+    *pptr() = '\0'; // there's always room; see SetChunk().
+    auto next = std::min(pptr() + 1, epptr());
+    setp(next, epptr());
+    mStart = next;
+    return message;
   }
 
-  if (*filter == kFilterWildcard) // next character is wildcard -- we either match or ignore the next character of id.
+  void Reset()
   {
-    return FilterMatch(filter + 1, filterEnd, id, idEnd) ||
-      FilterMatch(filter, filterEnd, id + 1, idEnd);
+    mChunk = 0;
+    mUsed = sizeof(mFirst);
+    SetChunk(mFirst, sizeof(mFirst));
+    mStart = mFirst;
   }
 
-  return false; // mismatch -- fail.
-}
+protected:
+  int_type overflow(int_type c) override
+  {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+    {
+      return traits_type::not_eof(c);
+    }
 
-///@brief Attempts to match the colon-delimited string of @a filters to the id in
-/// the [ @a id, @a idEnd ) range.
-///@return true if any of the filters have matched, false otherwise.
-bool FiltersMatch(std::string const& filters, char const* id, char const* idEnd)
-{
-  assert(id);
-  assert(idEnd >= id);
+    size_t size = pptr() - mStart;
+    if (!Grow(size + 2))
+    {
+      return traits_type::eof();
+    }
 
-  auto i = filters.c_str();
-  auto iEnd = i + filters.size();
-  while (i != iEnd)
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+  }
+
+private:
+  struct Chunk
   {
-    auto subEnd = i + strcspn(i, ":");
-    if (FilterMatch(i, subEnd, id, idEnd))
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  char mFirst[1024];
+  std::vector<Chunk> mChunks; // beyond mFirst
+  size_t mChunk;  // 0 for mFirst, otherwise the index into mChunks + 1
+  size_t mUsed; // the combined size of the chunks up to, and including mChunk
+  char* mStart;
+
+  ///@brief Moves the current message into a chunk that's at least @a size bytes.
+  bool Grow(size_t size)
+  {
+    auto lastSize = mChunk > 0 ? mChunks[mChunk - 1].size : sizeof(mFirst);
+    if (mChunk < mChunks.size() &&
+      (mChunks[mChunk].size < size || mUsed + mChunks[mChunk].size > sMessageLimit))
     {
-      return true;
+      mChunks.resize(mChunk); // Not to be used; the rest will be replaced.
     }
 
-    i = subEnd + (subEnd != iEnd);
+    if (mChunk == mChunks.size())
+    {
+      auto chunkSize = std::max(lastSize * 2, size);
+      if (mUsed + chunkSize > sMessageLimit)
+      {
+        chunkSize = sMessageLimit > mUsed ? sMessageLimit - mUsed : 0;
+      }
+
+      if (chunkSize < size)
+      {
+        return false;
+      }
+
+      detail::AllocationPause pause;
+      mChunks.push_back({ std::unique_ptr<char[]>(new char[chunkSize]), chunkSize });
+    }
+
+    auto& chunk = mChunks[mChunk];
+    ++mChunk;
+    mUsed += chunk.size;
+
+    auto length = size_t(pptr() - mStart);
+    memcpy(chunk.data.get(), mStart, length);
+    SetChunk(chunk.data.get(), chunk.size);
+    pbump(int(length));
+    mStart = chunk.data.get();
+    return true;
   }
-  return false;
-}
 
-///@brief Determines if the combination of the given @a suite and @a name (joined
-/// by a '_') is allowed through the filters.
-bool IsAllowed(char const* suite, char const* name)
-{
-  auto idLen = snprintf(sMessageBuffer, sizeof(sMessageBuffer), "%s%c%s",
-    suite, kJoinTestSuiteName, name);
-  auto idEnd = sMessageBuffer + idLen;
-  return FiltersMatch(sIncludeFilter, sMessageBuffer, idEnd) &&
-    !FiltersMatch(sExcludeFilter, sMessageBuffer, idEnd);
-}
+  void SetChunk(char* data, size_t size)
+  {
+    setp(data, data + size - 1);  // Reserve a byte for the terminator.
+  }
+};
 
-} // nonamespace
+thread_local MessageArena sMessages;
 
-void SetOutput(std::ostream& out)
-{
-  sOutput = &out;
-#ifdef _WIN32
-  sOutputHandle =
-    (&out == &std::cout) ? GetStdHandle(STD_OUTPUT_HANDLE) :
-    (&out == &std::cerr) ? GetStdHandle(STD_ERROR_HANDLE) :
-    nullptr;
+#if defined XM_DETAIL_USE_SECTION
+// The bounds of the section of pointers to test descriptors, which the linker provides
+// - unless there are no tests, hence weak, and null then.
+extern "C" __attribute__((weak)) detail::TestDescriptor const* const __start_xm_tests[];
+extern "C" __attribute__((weak)) detail::TestDescriptor const* const __stop_xm_tests[];
+#else
+detail::Registration* sFirstRegistration = nullptr;
+detail::Registration* sLastRegistration = nullptr;
 #endif
-}
 
-void SetFilter(char const* filterStr)
+detail::SuiteFixtureBase* sFirstSuiteFixture = nullptr;
+
+detail::Timeout* sFirstTimeout = nullptr;
+
+thread_local char const* sError = nullptr;
+
+// The context of the test that this thread is running - or helping with, through
+// a ThreadGuard -, if any.
+thread_local detail::TestContext* sContext = nullptr;
+thread_local bool sInGuard = false;
+
+// The context of the test running in this process, while it's the only one, which
+// the failures on threads outside of any test (without a ThreadGuard) are recorded
+// in. Otherwise they're counted in sStrayFailures, and fail the run.
+std::mutex sSoleContextMutex;
+detail::TestContext* sSoleContext = nullptr;
+size_t sNumRunningTests = 0;
+std::atomic<size_t> sStrayFailures{ 0 };
+
+// Counts the test of @a context as running, for the lifetime of the object; see
+// sSoleContext.
+class RunningTest
 {
-  sIncludeFilter.assign(1, kFilterWildcard);
-  sExcludeFilter.clear();
-  if (filterStr)
+public:
+  explicit RunningTest(detail::TestContext& context)
   {
-    auto negative = filterStr + strcspn(filterStr, "-");
-    if (negative > filterStr)
-    {
-      sIncludeFilter.assign(filterStr, negative);
-    }
+    std::lock_guard<std::mutex> lock(sSoleContextMutex);
+    ++sNumRunningTests;
+    sSoleContext = sNumRunningTests == 1 ? &context : nullptr;
+  }
 
-    if (*negative == '-')
-    {
-      ++negative;
-      auto end = negative + strcspn(negative, "\0");
-      sExcludeFilter.assign(negative, end);
-    }
+  ~RunningTest()
+  {
+    std::lock_guard<std::mutex> lock(sSoleContextMutex);
+    --sNumRunningTests;
+    sSoleContext = nullptr; // that of any other test that's still running isn't known.
   }
-}
 
-int RunTests()
+private:
+  RunningTest(RunningTest const&) = delete;
+  RunningTest& operator=(RunningTest const&) = delete;
+};
+
+// The number of scopes on this thread that catch failures, i.e. where Fail() may throw.
+thread_local int sCatchDepth = 0;
+
+struct CatchScope
 {
-  int run = 0;
-  int passed = 0;
-  int ignored = 0;
-  char const* lastSuite = nullptr;
-  auto test = sFirst;
-  while (test)
+  CatchScope() { ++sCatchDepth; }
+  ~CatchScope() { --sCatchDepth; }
+};
+
+// Keeps the messages of the failed expectations of the test running on this thread,
+// until it's reported. Messages are bump allocated from chunks, which are kept for
+// the following tests, so once warmed up, recording a failure doesn't allocate.
+class FailureArena
+{
+public:
+  void Add(char const* message)
+  {
+    auto size = strlen(message);
+    auto record = static_cast<Record*>(Allocate(sizeof(Record) + size + 1));
+    record->next = nullptr;
+    record->size = size;
+    memcpy(record + 1, message, size + 1);
+
+    *mLastNext = record;
+    mLastNext = &record->next;
+    ++mCount;
+  }
+
+  size_t Count() const
+  {
+    return mCount;
+  }
+
+  ///@brief Appends the messages to @a str, each on a line of its own.
+  void AppendTo(std::string& str) const
   {
-    if (IsAllowed(test->mSuite, test->mName))
+    for (auto record = mFirst; record; record = record->next)
     {
-      if (test->mSuite != lastSuite)
+      if (!str.empty())
       {
-        *sOutput << "[" << kStatus[SUITE] << "] " << test->mSuite << std::endl;
-        lastSuite = test->mSuite;
+        str.append(1, '\n');
       }
+      str.append(reinterpret_cast<char const*>(record + 1), record->size);
+    }
+  }
 
-      *sOutput << "[" << kStatus[STARTED] << "] " << test->mSuite << kJoinTestSuiteName <<
-        test->mName << std::endl;
-      Clock clock;
-      bool result = test->Run();
-      double tDelta = clock.Measure();
-      *sOutput << StreamColor{ uint16_t(result ? FOREGROUND_GREEN : FOREGROUND_RED ) } <<
-        "[" << kStatus[result] << "] " << test->mSuite << kJoinTestSuiteName << test->mName <<
-        " (" << tDelta << "ms)" << StreamColor{ FOREGROUND_RESET } << std::endl;
-      if (result)
-      {
-        ++passed;
-      }
-      else if (sError)
-      {
-        *sOutput << sError << std::endl;
-        sError = nullptr;
-      }
-      ++run;
+  void Reset()
+  {
+    mFirst = nullptr;
+    mLastNext = &mFirst;
+    mCount = 0;
+    mChunk = 0;
+    mUsed = 0;
+  }
+
+private:
+  struct Record
+  {
+    Record* next;
+    size_t size;
+  };
+
+  struct Chunk
+  {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  enum : size_t { kChunkSize = 4096 };
+
+  std::vector<Chunk> mChunks;
+  size_t mChunk = 0;
+  size_t mUsed = 0;
+  Record* mFirst = nullptr;
+  Record** mLastNext = &mFirst;
+  size_t mCount = 0;
+
+  void* Allocate(size_t size)
+  {
+    size = (size + alignof(Record) - 1) & ~(alignof(Record) - 1);
+    while (mChunk < mChunks.size() && mUsed + size > mChunks[mChunk].size)
+    {
+      ++mChunk;
+      mUsed = 0;
     }
-    else
+
+    if (mChunk == mChunks.size())
     {
-      ++ignored;
+      detail::AllocationPause pause;
+      auto chunkSize = std::max(size, size_t(kChunkSize));
+      mChunks.push_back({ std::unique_ptr<char[]>(new char[chunkSize]), chunkSize });
+      mUsed = 0;
     }
 
-    test = test->mNext;
+    auto p = mChunks[mChunk].data.get() + mUsed;
+    mUsed += size;
+    return p;
   }
+};
 
-  *sOutput << "[" << kStatus[SUITE] << "]" << std::endl;
-  *sOutput << "[" << kStatus[TALLY] << "] " << run << " tests run." << std::endl;
-  *sOutput << "[" << kStatus[TALLY] << "] " << passed << " tests passed." << std::endl;
-  if (ignored > 0)
-  {
-    *sOutput << "[" << kStatus[TALLY] << "] " << ignored << " tests ignored." << std::endl;
-  }
+thread_local FailureArena sFailures;
 
-  const bool endResult = passed == run;
-  *sOutput << StreamColor{ uint16_t(endResult ? FOREGROUND_GREEN : FOREGROUND_RED) } <<
-    "[" << kStatus[endResult] << "] Final result." << StreamColor{ FOREGROUND_RESET } << std::endl;
+std::ostream* sOutput = &std::cout;
 
-  return run - passed;
-}
+unsigned int sConcurrency = 1;
+bool sConcurrencySet = false;
 
-namespace detail
+bool sIsolation = false;
+bool sPerfCounters = false;
+
+bool sShardSet = false;
+unsigned int sShardIndex = 0;
+unsigned int sShardCount = 0;
+bool sShardSummarySet = false;
+std::string sShardSummary;
+
+std::string sTimingCache;
+std::string sTraceFile;
+
+unsigned int sSlowestCount = 5;
+bool sFailFast = false;
+bool sListOnly = false;
+unsigned int sRepeatCount = 0; // unlimited with sUntilFail, otherwise once, if 0
+bool sUntilFail = false;
+bool sShuffle = false;
+uint64_t sShuffleSeed = 0;  // picked at random if 0
+double sDefaultTimeout = .0;  // milliseconds; none if 0
+constexpr double kTimeoutWarningRatio = .8;
+RerunMode sRerunMode = RerunMode::kAll;
+
+// The duration, in milliseconds, and outcome of a test from earlier runs.
+struct TestHistory
 {
+  float duration;
+  bool failed;
+};
 
-std::ostream& operator<<(std::ostream& os, StringWrap const& sw)
+// The histories of tests, keyed by HashId().
+using TimingCache = std::map<uint64_t, TestHistory>;
+
+constexpr char kTimingCacheMagic[4]{ 'X', 'M', 'T', 'C' };
+constexpr uint32_t kTimingCacheVersion = 2;
+
+// The weight of the latest run in the duration recorded in the timing cache.
+constexpr float kTimingCacheLatestWeight = .5f;
+
+///@brief Reads the timing cache at @a path, which is a header of magic, version
+/// and count, followed by count entries of a uint64_t id hash, a float duration
+/// and (since version 2) a uint8_t, which is 1 if the test has failed last time.
+///@return false if the file could not be opened or wasn't a timing cache.
+bool LoadTimingCache(char const* path, TimingCache& cache)
 {
-  auto i0 = sw.mString;
-  auto i1 = i0 + sw.mSize;
-  while (i0 != i1)
+  std::ifstream file(path, std::ios::binary);
+  char magic[sizeof(kTimingCacheMagic)];
+  uint32_t version;
+  uint32_t count;
+  if (!file.read(magic, sizeof(magic)) || memcmp(magic, kTimingCacheMagic, sizeof(magic)) != 0 ||
+    !file.read(reinterpret_cast<char*>(&version), sizeof(version)) ||
+    version < 1 || version > kTimingCacheVersion ||
+    !file.read(reinterpret_cast<char*>(&count), sizeof(count)))
   {
-    os.put(*i0);
-    ++i0;
+    return false;
   }
-  return os;
-}
 
-StaticStringBuilder::StaticStringBuilder()
-: mStream(&sStreamBuf)
-{}
+  uint64_t hash;
+  float duration;
+  uint8_t failed = 0;
+  while (count > 0 && file.read(reinterpret_cast<char*>(&hash), sizeof(hash)) &&
+    file.read(reinterpret_cast<char*>(&duration), sizeof(duration)) &&
+    (version < 2 || file.read(reinterpret_cast<char*>(&failed), sizeof(failed))))
+  {
+    cache[hash] = TestHistory{ duration, failed != 0 };
+    --count;
+  }
+  return true;
+}
 
-StaticStringBuilder::~StaticStringBuilder()
+///@brief Writes @a cache to @a path, in the format read by LoadTimingCache().
+///@return false if the file could not be written.
+bool SaveTimingCache(char const* path, TimingCache const& cache)
 {
-  mStream << '\0';
-  sStreamBuf.Reset();
+  std::ofstream file(path, std::ios::binary);
+  auto count = uint32_t(cache.size());
+  file.write(kTimingCacheMagic, sizeof(kTimingCacheMagic));
+  file.write(reinterpret_cast<char const*>(&kTimingCacheVersion), sizeof(kTimingCacheVersion));
+  file.write(reinterpret_cast<char const*>(&count), sizeof(count));
+  for (auto& entry : cache)
+  {
+    uint8_t failed = entry.second.failed;
+    file.write(reinterpret_cast<char const*>(&entry.first), sizeof(entry.first));
+    file.write(reinterpret_cast<char const*>(&entry.second.duration), sizeof(entry.second.duration));
+    file.write(reinterpret_cast<char const*>(&failed), sizeof(failed));
+  }
+  return !!file.flush();
 }
 
-StaticStringBuilder::operator char const*() const
+///@brief Assigns the items of the given @a costs to @a bins, so as to balance
+/// their total cost, using the longest processing time first heuristic: items
+/// are taken in descending order of cost (ascending index for ties), and each
+/// goes to the bin with the lowest total so far (lowest index for ties).
+///@return The indices of the items, for each bin, in the order assigned.
+std::vector<std::vector<size_t>> AssignLongestFirst(std::vector<double> const& costs,
+  size_t numBins)
 {
-  return sMessageBuffer;
+  std::vector<size_t> order(costs.size());
+  for (size_t i = 0; i < order.size(); ++i)
+  {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&costs](size_t a, size_t b) {
+    return costs[a] > costs[b];
+  });
+
+  std::vector<std::vector<size_t>> bins(numBins);
+  std::vector<double> loads(numBins, .0);
+  for (auto i : order)
+  {
+    auto iMin = std::min_element(loads.begin(), loads.end()) - loads.begin();
+    bins[iMin].push_back(i);
+    loads[iMin] += costs[i];
+  }
+  return bins;
 }
 
-char const* Formatter::Format(char const* str)
+///@brief Shuffles the elements in [ @a i, @a iEnd ) with @a rng (Fisher-Yates), in
+/// the same order on all platforms.
+template <typename Iterator>
+void Shuffle(Iterator i, Iterator iEnd, Rng& rng)
 {
-  StaticStringBuilder ssb;
-  auto& stream = ssb.Stream();
-  stream << "Expected: " << str;
-
-  return ssb;
+  for (auto n = size_t(iEnd - i); n > 1; --n)
+  {
+    std::swap(i[n - 1], i[rng.Below(n)]);
+  }
 }
 
-void Fail(char const* message)
+double sBenchmarkTime = 500.;
+unsigned int sBenchmarkSamples = 10;
+
+constexpr uint64_t kMaxBenchmarkIterations = uint64_t(1) << 40;
+
+std::string sBenchmarkBaseline;
+std::string sBenchmarkRecord;
+double sBenchmarkThreshold = .05;
+
+unsigned int sPropertyCases = 100;
+uint64_t sPropertySeed = 0; // picked at random for each run if 0
+unsigned int sPropertyThreads = 0;  // automatic if 0
+
+uint64_t sRunPropertySeed = 0;  // of the current run; see SetPropertySeed().
+size_t sNumRunWorkers = 1;  // that the current run is on.
+
+// The significance level below which a difference of benchmark samples from their
+// baseline is not considered to be down to chance.
+constexpr double kBenchmarkSignificance = .05;
+
+// Samples of benchmarks' time per iteration from a previous run, keyed by test id.
+using Baseline = std::map<std::string, std::vector<double>>;
+
+// The most samples that a benchmark may have in a baseline; far more than a run
+// would take, but a bound on a corrupt count.
+constexpr size_t kMaxBaselineSamples = 1 << 16;
+
+///@brief Reads @a in, which has a line of "<id> <n> <sample 1> ... <sample n>" per
+/// benchmark, into @a baseline.
+///@return false if @a in isn't a well-formed baseline, in which case @a baseline is
+/// left empty.
+bool ReadBaseline(std::istream& in, Baseline& baseline)
 {
-  throw Exception{ message };
+  std::string id;
+  size_t n;
+  while (in >> id)
+  {
+    if (!(in >> n) || n == 0 || n > kMaxBaselineSamples)
+    {
+      baseline.clear();
+      return false;
+    }
+
+    auto& samples = baseline[id];
+    samples.resize(n);
+    for (auto& s : samples)
+    {
+      if (!(in >> s) || !std::isfinite(s) || s < .0)
+      {
+        baseline.clear();
+        return false;
+      }
+    }
+  }
+  return true;
 }
 
-void Assert::True(bool value, char const* str)
+///@brief Reads the file at @a path into @a baseline; see ReadBaseline().
+///@return false if the file could not be opened, or is corrupt.
+bool LoadBaseline(char const* path, Baseline& baseline)
 {
-  Check(value, Formatter::Format(str));
+  std::ifstream file(path);
+  return file && ReadBaseline(file, baseline);
 }
 
-void Assert::Check(bool value, char const* message)
+///@brief Writes @a baseline to the file at @a path, in the format read by LoadBaseline().
+///@return false if the file could not be written.
+bool SaveBaseline(char const* path, Baseline const& baseline)
 {
-  if (!value)
+  std::ofstream file(path);
+  file.precision(9);
+  for (auto& entry : baseline)
   {
-    Fail(message);
+    file << entry.first << ' ' << entry.second.size();
+    for (auto s : entry.second)
+    {
+      file << ' ' << s;
+    }
+    file << '\n';
   }
+  return !!file.flush();
 }
 
-Test::Test(char const* suite, char const* name)
-: mSuite(suite),
-  mName(name)
+///@brief Performs a one-sided Mann-Whitney U test on samples @a a and @a b, using
+/// the normal approximation with tie and continuity correction.
+///@return The probability of the values in @a b being no greater than the
+/// ones in @a a, i.e. a low value suggests that b is greater.
+double MannWhitneyP(std::vector<double> const& a, std::vector<double> const& b)
 {
-  if (sLast)
+  struct Sample
+  {
+    double value;
+    bool isB;
+  };
+
+  std::vector<Sample> all;
+  all.reserve(a.size() + b.size());
+  for (auto v : a)
   {
-    sLast->mNext = this;
+    all.push_back({ v, false });
   }
-  else if (!sFirst)
+  for (auto v : b)
   {
-    sFirst = this;
+    all.push_back({ v, true });
   }
+  std::sort(all.begin(), all.end(), [](Sample const& x, Sample const& y) {
+    return x.value < y.value;
+  });
 
-  sLast = this;
-}
+  // Sum ranks of b, averaging ranks of ties.
+  double rankSumB = .0;
+  double tieCorrection = .0;
+  for (size_t i = 0; i < all.size();)
+  {
+    size_t j = i + 1;
+    while (j < all.size() && all[j].value == all[i].value)
+    {
+      ++j;
+    }
 
-Test::~Test() = default;
+    double rank = (i + j + 1) * .5;
+    for (size_t k = i; k < j; ++k)
+    {
+      rankSumB += all[k].isB ? rank : .0;
+    }
 
-bool Test::Run()
-{
-  try
-  {
-    RunInternal();
-    return true;
-  }
-  catch (Exception const& e)
-  {
-    sError = e.message;
-    return false;
+    double t = double(j - i);
+    tieCorrection += t * t * t - t;
+    i = j;
   }
-  catch (...)
+
+  double n1 = double(a.size());
+  double n2 = double(b.size());
+  double n = n1 + n2;
+  double u = rankSumB - n2 * (n2 + 1.) * .5;
+  double sigma = std::sqrt(n1 * n2 / 12. * ((n + 1.) - tieCorrection / (n * (n - 1.))));
+  if (sigma <= .0)
   {
-    sError = "Bad exception thrown.";
-    return false;
+    return 1.;
   }
-}
 
-} // detail
-} // xm
+  double z = (u - n1 * n2 * .5 - .5) / sigma;
+  return .5 * std::erfc(z / std::sqrt(2.));
+}
 
-#if defined XM_SELF_TEST
+///@return The median of @a samples, which mustn't be empty.
+double Median(std::vector<double> samples)
+{
+  std::sort(samples.begin(), samples.end());
+  auto n = samples.size();
+  return n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) * .5;
+}
 
-XM_TEST(Xm, FilterMatch)
+// The samples of a benchmark, and the statistics calculated from them. iterations
+// is 0 if the test wasn't a benchmark.
+struct BenchStats : BenchmarkResult
 {
-  auto filter = [](std::string_view const& filter, std::string_view const& id) {
-    return xm::FilterMatch(filter.data(), filter.data() + filter.size(), id.data(), id.data() + id.size());
-  };
+  std::vector<double> samples;
 
-  XM_ASSERT_TRUE(filter("A*", "A"));
-  XM_ASSERT_TRUE(filter("A*", "AB"));
-  XM_ASSERT_TRUE(filter("A*", "ABC"));
+  void Calculate()
+  {
+    auto n = samples.size();
+    numSamples = n;
+    min = *std::min_element(samples.begin(), samples.end());
+    median = Median(samples);
+
+    double sum = .0;
+    for (auto s : samples)
+    {
+      sum += s;
+    }
+    mean = sum / n;
+
+    double sumSquares = .0;
+    for (auto s : samples)
+    {
+      sumSquares += (s - mean) * (s - mean);
+    }
+    stddev = n > 1 ? std::sqrt(sumSquares / (n - 1)) : .0;
+  }
+};
+
+struct Result
+{
+  bool passed = false;
+  double duration = .0;
+  std::string error;
+  BenchStats bench;
+  size_t assertions = 0;
+  AllocationStats allocations;
+  PerfCounters counters;
+  ResourceUsage usage;
+  bool done = false;
+};
+
+thread_local Result* sResult = nullptr; // Of the test running on this thread, if any.
+
+#if defined XM_TRACK_ALLOCATIONS
+constexpr bool kTrackAllocations = true;
+#else
+constexpr bool kTrackAllocations = false;
+#endif
+
+// The allocations of the current test on this thread. Each test gets a window
+// with a unique, non-zero id, which the blocks that it allocates are tagged with,
+// so that only the deallocation of those affects its live bytes.
+struct AllocationCounter
+{
+  uint32_t window = 0;
+  bool paused = false;
+  size_t count = 0;
+  size_t bytes = 0;
+  int64_t liveBytes = 0;
+  int64_t peakBytes = 0;
+};
+
+thread_local AllocationCounter sAllocations;
+std::atomic<uint32_t> sNextAllocationWindow{ 1 };
+
+#if defined XM_TRACK_ALLOCATIONS
+struct alignas(std::max_align_t) AllocationHeader
+{
+  size_t size;
+  uint32_t window;
+};
+
+[[noreturn]] void ThrowBadAlloc()
+{
+#if defined XM_HAS_EXCEPTIONS
+  throw std::bad_alloc();
+#else
+  std::abort();
+#endif
+}
+
+///@return The allocated block; nullptr only if it failed, and @a noThrow is true.
+void* Allocate(size_t size, bool noThrow)
+{
+  void* p = nullptr;
+  if (size > SIZE_MAX - sizeof(AllocationHeader))
+  {
+    if (noThrow)
+    {
+      return p;
+    }
+    ThrowBadAlloc();
+  }
+
+  while (!(p = malloc(sizeof(AllocationHeader) + size)))
+  {
+    auto handler = std::get_new_handler();
+    if (!handler)
+    {
+      if (noThrow)
+      {
+        return p;
+      }
+      ThrowBadAlloc();
+    }
+    handler();
+  }
+
+  auto header = new (p) AllocationHeader{ size, 0 };
+  auto& counter = sAllocations;
+  if (counter.window != 0 && !counter.paused)
+  {
+    header->window = counter.window;
+    ++counter.count;
+    counter.bytes += size;
+    counter.liveBytes += int64_t(size);
+    counter.peakBytes = std::max(counter.peakBytes, counter.liveBytes);
+  }
+  return header + 1;
+}
+
+void Deallocate(void* p)
+{
+  if (!p)
+  {
+    return;
+  }
+
+  auto header = static_cast<AllocationHeader*>(p) - 1;
+  auto& counter = sAllocations;
+  if (header->window != 0 && header->window == counter.window)
+  {
+    counter.liveBytes -= int64_t(header->size);
+  }
+  free(header);
+}
+#endif
+
+void StartCountingAllocations()
+{
+  uint32_t window;
+  do
+  {
+    window = sNextAllocationWindow++;
+  } while (window == 0);
+
+  sAllocations = AllocationCounter{};
+  sAllocations.window = window;
+}
+
+AllocationStats StopCountingAllocations()
+{
+  auto& counter = sAllocations;
+  AllocationStats stats;
+  stats.count = counter.count;
+  stats.bytes = counter.bytes;
+  stats.peakBytes = size_t(counter.peakBytes);
+  stats.leakedBytes = size_t(std::max(counter.liveBytes, int64_t(0)));
+  counter.window = 0;
+  return stats;
+}
+
+// The counters of PerfCounters, in the order of their bits.
+struct PerfCounterInfo
+{
+  uint32_t bit;
+  uint64_t PerfCounters::*count;
+  char const* name;
+  char const* key;  // for structured reports
+};
+
+constexpr PerfCounterInfo kPerfCounters[]{
+  { PerfCounters::kCycles, &PerfCounters::cycles, "cycles", "cycles" },
+  { PerfCounters::kInstructions, &PerfCounters::instructions, "instructions", "instructions" },
+  { PerfCounters::kCacheMisses, &PerfCounters::cacheMisses, "cache misses", "cache_misses" },
+  { PerfCounters::kBranchMisses, &PerfCounters::branchMisses, "branch misses", "branch_misses" },
+  { PerfCounters::kContextSwitches, &PerfCounters::contextSwitches, "context switches",
+    "context_switches" },
+};
+
+// The counters that are recorded per iteration of benchmarks, alongside their samples
+// - as "<id>:<key> 1 <count>" -, and gated on like their times; see CompareToBaseline().
+constexpr uint32_t kBaselineCounters = PerfCounters::kInstructions | PerfCounters::kCacheMisses;
+
+// Counts the events of PerfCounters on the thread that it's created on. On Linux, the
+// hardware events are opened as a single group of perf events, so that they're all
+// counted over the same time, and scaled up by the ratio of the time the group was
+// enabled to the time it was running, in case that it was multiplexed with others;
+// the context switches come from getrusage(). On Windows, the cycles are counted by
+// QueryThreadCycleTime(). Elsewhere nothing is.
+class PerfEventGroup
+{
+public:
+  PerfEventGroup()
+  {
+    Open();
+  }
+
+  ~PerfEventGroup()
+  {
+    Close();
+  }
+
+  ///@return The counts since the group was opened.
+  PerfCounters Read()
+  {
+    PerfCounters counters;
+#if defined __linux__
+    if (mPid != getpid())
+    {
+      Close();  // The group was inherited from the parent process; count this one.
+      Open();
+    }
+
+    if (mNumEvents > 0)
+    {
+      uint64_t values[3 + std::size(kEvents)];  // count, time enabled, running, values
+      auto size = ssize_t(sizeof(uint64_t) * (3 + mNumEvents));
+      if (read(mFds[0], values, size_t(size)) == size && values[2] > 0)
+      {
+        auto scale = double(values[1]) / double(values[2]);
+        for (size_t i = 0; i < mNumEvents; ++i)
+        {
+          auto& info = kPerfCounters[mEvents[i]];
+          counters.*info.count = uint64_t(double(values[3 + i]) * scale);
+          counters.available |= info.bit;
+        }
+      }
+    }
+
+    rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) == 0)
+    {
+      counters.contextSwitches = uint64_t(usage.ru_nvcsw + usage.ru_nivcsw);
+      counters.available |= PerfCounters::kContextSwitches;
+    }
+#elif defined _WIN32
+    ULONG64 cycles;
+    if (QueryThreadCycleTime(GetCurrentThread(), &cycles))
+    {
+      counters.cycles = cycles;
+      counters.available |= PerfCounters::kCycles;
+    }
+#endif
+    return counters;
+  }
+
+private:
+#if defined __linux__
+  // The hardware events, by their index in kPerfCounters; the first one that can be
+  // opened leads the group.
+  static constexpr std::pair<size_t, uint64_t> kEvents[]{
+    { 0, PERF_COUNT_HW_CPU_CYCLES },
+    { 1, PERF_COUNT_HW_INSTRUCTIONS },
+    { 2, PERF_COUNT_HW_CACHE_MISSES },
+    { 3, PERF_COUNT_HW_BRANCH_MISSES },
+  };
+
+  pid_t mPid = 0;
+  int mFds[std::size(kEvents)];
+  size_t mEvents[std::size(kEvents)];
+  size_t mNumEvents = 0;
+
+  void Open()
+  {
+    mPid = getpid();
+    for (auto& event : kEvents)
+    {
+      perf_event_attr attr{};
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = event.second;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+        PERF_FORMAT_TOTAL_TIME_RUNNING;
+      auto fd = int(syscall(SYS_perf_event_open, &attr, 0, -1,
+        mNumEvents > 0 ? mFds[0] : -1, PERF_FLAG_FD_CLOEXEC));
+      if (fd >= 0)
+      {
+        mFds[mNumEvents] = fd;
+        mEvents[mNumEvents] = event.first;
+        ++mNumEvents;
+      }
+    }
+  }
+
+  void Close()
+  {
+    while (mNumEvents > 0)
+    {
+      close(mFds[--mNumEvents]);
+    }
+  }
+#else
+  void Open()
+  {}
+
+  void Close()
+  {}
+#endif
+};
+
+///@return The counts of the events of this thread so far.
+PerfCounters ReadPerfCounters()
+{
+  thread_local PerfEventGroup sGroup;
+  return sGroup.Read();
+}
+
+// Adds the counts from @a begin to @a end to @a counters, which is left with the
+// counters that were available in both.
+void AddPerfCounters(PerfCounters const& begin, PerfCounters const& end, PerfCounters& counters)
+{
+  counters.available = begin.available & end.available;
+  for (auto& info : kPerfCounters)
+  {
+    counters.*info.count = (counters.available & info.bit) ?
+      counters.*info.count + (end.*info.count - begin.*info.count) : 0;
+  }
+}
+
+// The CPU times of this thread - or process, where the platform doesn't have them by
+// thread - and the peak resident set of the process, so far. Where a CPU time clock
+// is available, @e cpuNs has the total at a finer resolution than user and system
+// time, which getrusage() may only advance by a scheduler tick.
+struct UsageSample
+{
+  int64_t userNs = 0;
+  int64_t systemNs = 0;
+  int64_t cpuNs = -1; // if available
+  size_t peakRss = 0;  // bytes
+};
+
+UsageSample SampleUsage()
+{
+  UsageSample sample;
+#if defined _WIN32
+  FILETIME creation, exit, kernel, user;
+  if (GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+  {
+    auto toNs = [](FILETIME const& time) {
+      return int64_t((uint64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 100;
+    };
+    sample.userNs = toNs(user);
+    sample.systemNs = toNs(kernel);
+  }
+
+  PROCESS_MEMORY_COUNTERS memory;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory)))
+  {
+    sample.peakRss = memory.PeakWorkingSetSize;
+  }
+#else
+  auto toNs = [](timeval const& time) {
+    return int64_t(time.tv_sec) * 1000000000 + int64_t(time.tv_usec) * 1000;
+  };
+  rusage usage;
+#if defined RUSAGE_THREAD
+  if (getrusage(RUSAGE_THREAD, &usage) == 0)
+  {
+    sample.userNs = toNs(usage.ru_utime);
+    sample.systemNs = toNs(usage.ru_stime);
+  }
+
+  timespec cpu;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu) == 0)
+  {
+    sample.cpuNs = int64_t(cpu.tv_sec) * 1000000000 + cpu.tv_nsec;
+  }
+#endif
+
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+#if !defined RUSAGE_THREAD
+    sample.userNs = toNs(usage.ru_utime);
+    sample.systemNs = toNs(usage.ru_stime);
+#endif
+#if defined __APPLE__
+    sample.peakRss = size_t(usage.ru_maxrss);  // in bytes
+#else
+    sample.peakRss = size_t(usage.ru_maxrss) * 1024;  // in kilobytes
+#endif
+  }
+#endif
+  return sample;
+}
+
+ResourceUsage GetUsageSince(UsageSample const& begin)
+{
+  auto end = SampleUsage();
+  ResourceUsage usage;
+  auto userNs = double(end.userNs - begin.userNs);
+  auto systemNs = double(end.systemNs - begin.systemNs);
+  if (begin.cpuNs >= 0 && end.cpuNs >= 0)
+  {
+    // Split the precise total in the ratio of the coarse user and system times.
+    auto cpuNs = double(end.cpuNs - begin.cpuNs);
+    auto coarseNs = userNs + systemNs;
+    systemNs = coarseNs > .0 ? cpuNs * systemNs / coarseNs : .0;
+    userNs = coarseNs > .0 ? cpuNs * userNs / coarseNs : cpuNs;
+  }
+  usage.userMs = userNs * 1e-6;
+  usage.systemMs = systemNs * 1e-6;
+  usage.peakRssGrowth = end.peakRss > begin.peakRss ? end.peakRss - begin.peakRss : 0;
+  return usage;
+}
+
+// An event of the timeline of the run; see SetTraceFile().
+struct TraceEvent
+{
+  enum Kind : uint8_t
+  {
+    kTest,  // a slice of @e suite and @e name
+    kSlice, // a slice of a test, @e name
+    kFailure, // a marker of the failure of @e suite and @e name, at @e endNs
+  };
+
+  Kind kind;
+  char const* suite;
+  char const* name;
+  int64_t beginNs;
+  int64_t endNs;
+};
+
+// The latest events of a thread, in a ring buffer. Buffers are kept past the end of
+// their threads - retired -, until the trace is written.
+struct TraceBuffer
+{
+  static constexpr size_t kSize = 1 << 14;
+
+  std::unique_ptr<TraceEvent[]> events{ new TraceEvent[kSize] };
+  size_t count = 0; // of the events recorded, including those overwritten.
+  size_t thread = 0;  // the order that it was created in
+  bool retired = false;
+};
+
+std::mutex sTraceMutex; // of sTraceBuffers, which is only locked once per thread.
+std::vector<std::unique_ptr<TraceBuffer>> sTraceBuffers;
+size_t sNumTraceThreads = 0;
+bool sTracing = false;  // for the current RunTests()
+int64_t sTraceStartNs = 0;
+
+// Retires the buffer of a thread when it exits.
+struct TraceBufferHolder
+{
+  TraceBuffer* buffer = nullptr;
+
+  ~TraceBufferHolder()
+  {
+    if (buffer)
+    {
+      std::lock_guard<std::mutex> lock(sTraceMutex);
+      buffer->retired = true;
+    }
+  }
+};
+
+thread_local TraceBufferHolder sTraceBuffer;
+
+void Trace(TraceEvent::Kind kind, char const* suite, char const* name, int64_t beginNs,
+  int64_t endNs)
+{
+  auto& buffer = sTraceBuffer.buffer;
+  if (!buffer)
+  {
+    detail::AllocationPause pause;
+    std::lock_guard<std::mutex> lock(sTraceMutex);
+    sTraceBuffers.emplace_back(new TraceBuffer);
+    buffer = sTraceBuffers.back().get();
+    buffer->thread = ++sNumTraceThreads;
+  }
+
+  buffer->events[buffer->count++ % TraceBuffer::kSize] =
+    TraceEvent{ kind, suite, name, beginNs, endNs };
+}
+
+// Serializes values into a byte buffer, for sending across processes.
+struct Packer
+{
+  std::string mData;
+
+  template <typename T>
+  void Put(T const& value)
+  {
+    static_assert(std::is_trivially_copyable_v<T>);
+    mData.append(reinterpret_cast<char const*>(&value), sizeof(T));
+  }
+
+  void Put(std::string const& str)
+  {
+    Put(str.size());
+    mData.append(str);
+  }
+
+  void Put(std::vector<double> const& values)
+  {
+    Put(values.size());
+    mData.append(reinterpret_cast<char const*>(values.data()), values.size() * sizeof(double));
+  }
+};
+
+// Deserializes values written by a Packer.
+struct Unpacker
+{
+  char const* mRead;
+  char const* mEnd;
+
+  template <typename T>
+  bool Get(T& value)
+  {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (size_t(mEnd - mRead) < sizeof(T))
+    {
+      return false;
+    }
+
+    memcpy(&value, mRead, sizeof(T));
+    mRead += sizeof(T);
+    return true;
+  }
+
+  bool Get(std::string& str)
+  {
+    size_t size;
+    if (!Get(size) || size_t(mEnd - mRead) < size)
+    {
+      return false;
+    }
+
+    str.assign(mRead, size);
+    mRead += size;
+    return true;
+  }
+
+  bool Get(std::vector<double>& values)
+  {
+    size_t size;
+    if (!Get(size) || size_t(mEnd - mRead) / sizeof(double) < size)
+    {
+      return false;
+    }
+
+    values.resize(size);
+    memcpy(values.data(), mRead, size * sizeof(double));
+    mRead += size * sizeof(double);
+    return true;
+  }
+};
+
+void Pack(Result const& result, Packer& packer)
+{
+  packer.Put(result.passed);
+  packer.Put(result.duration);
+  packer.Put(result.error);
+  packer.Put(static_cast<BenchmarkResult const&>(result.bench));
+  packer.Put(result.bench.samples);
+  packer.Put(result.assertions);
+  packer.Put(result.allocations);
+  packer.Put(result.counters);
+  packer.Put(result.usage);
+}
+
+bool Unpack(Unpacker& unpacker, Result& result)
+{
+  return unpacker.Get(result.passed) &&
+    unpacker.Get(result.duration) &&
+    unpacker.Get(result.error) &&
+    unpacker.Get(static_cast<BenchmarkResult&>(result.bench)) &&
+    unpacker.Get(result.bench.samples) &&
+    unpacker.Get(result.assertions) &&
+    unpacker.Get(result.allocations) &&
+    unpacker.Get(result.counters) &&
+    unpacker.Get(result.usage);
+}
+
+#ifndef _WIN32
+bool WriteAll(int fd, void const* data, size_t size)
+{
+  auto p = static_cast<char const*>(data);
+  while (size > 0)
+  {
+    auto written = write(fd, p, size);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+
+    p += written;
+    size -= size_t(written);
+  }
+  return true;
+}
+
+bool ReadAll(int fd, void* data, size_t size)
+{
+  auto p = static_cast<char*>(data);
+  while (size > 0)
+  {
+    auto numRead = read(fd, p, size);
+    if (numRead <= 0)
+    {
+      if (numRead < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+
+    p += numRead;
+    size -= size_t(numRead);
+  }
+  return true;
+}
+
+///@brief Describes how a child process, of the given wait() @a status, has ended.
+std::string DescribeExit(int status)
+{
+  char buffer[128];
+  if (WIFSIGNALED(status))
+  {
+    auto sig = WTERMSIG(status);
+    char const* name = nullptr;
+    switch (sig)
+    {
+    case SIGSEGV: name = "SIGSEGV"; break;
+    case SIGABRT: name = "SIGABRT"; break;
+    case SIGBUS: name = "SIGBUS"; break;
+    case SIGFPE: name = "SIGFPE"; break;
+    case SIGILL: name = "SIGILL"; break;
+    case SIGKILL: name = "SIGKILL"; break;
+    case SIGTERM: name = "SIGTERM"; break;
+    case SIGTRAP: name = "SIGTRAP"; break;
+    case SIGPIPE: name = "SIGPIPE"; break;
+    case SIGALRM: name = "SIGALRM"; break;
+    default: break;
+    }
+
+    if (name)
+    {
+      snprintf(buffer, sizeof(buffer), "Crashed with signal %s (%s).", name, strsignal(sig));
+    }
+    else
+    {
+      snprintf(buffer, sizeof(buffer), "Crashed with signal %d (%s).", sig, strsignal(sig));
+    }
+  }
+  else if (WIFEXITED(status))
+  {
+    snprintf(buffer, sizeof(buffer), "Exited with status %d during the test.",
+      WEXITSTATUS(status));
+  }
+  else
+  {
+    snprintf(buffer, sizeof(buffer), "Ended abnormally.");
+  }
+  return buffer;
+}
+
+// Guards the creation of child processes, and the parent's ends of their pipes,
+// which each child must close, so that only the parent holds them.
+std::mutex sIsolatesMutex;
+std::vector<int> sIsolateFds;
+#endif
+
+///@brief Prints @a value into @a buffer, scaled to an SI prefix.
+void FormatSi(double value, char* buffer, size_t size)
+{
+  constexpr char const* kPrefixes[]{ "", "k", "M", "G", "T" };
+  size_t i = 0;
+  while (value >= 1000. && i + 1 < std::size(kPrefixes))
+  {
+    value /= 1000.;
+    ++i;
+  }
+  snprintf(buffer, size, "%.4g%s", value, kPrefixes[i]);
+}
+
+// A wildcard filter, compiled into the literal segments between its wildcards.
+// Segments that the filter doesn't start / end with a wildcard before / after,
+// are anchored to the start / end of the id; the rest are searched for, left to
+// right, using Knuth-Morris-Pratt. Therefore matching never backtracks, and takes
+// a single pass over the id.
+class Filter
+{
+public:
+  Filter(char const* filter, char const* filterEnd)
+  : mAnchorStart(filter != filterEnd && *filter != kFilterWildcard),
+    mAnchorEnd(filter != filterEnd && filterEnd[-1] != kFilterWildcard),
+    mHasWildcard(std::find(filter, filterEnd, kFilterWildcard) != filterEnd)
+  {
+    while (filter != filterEnd)
+    {
+      auto segmentEnd = std::find(filter, filterEnd, kFilterWildcard);
+      if (segmentEnd != filter)
+      {
+        mSegments.push_back(Segment(filter, segmentEnd));
+        mMinLength += mSegments.back().mLiteral.size();
+      }
+
+      filter = segmentEnd + (segmentEnd != filterEnd);
+    }
+  }
+
+  ///@return Whether the id in the [ @a id, @a idEnd ) range matches the filter.
+  bool Match(char const* id, char const* idEnd) const
+  {
+    assert(id);
+    assert(idEnd >= id);
+    if (size_t(idEnd - id) < mMinLength)
+    {
+      return false;
+    }
+
+    if (!mHasWildcard)
+    {
+      return size_t(idEnd - id) == mMinLength &&
+        std::equal(id, idEnd, mSegments.empty() ? id : mSegments.front().mLiteral.c_str());
+    }
+
+    auto i0 = mSegments.begin();
+    auto i1 = mSegments.end();
+    if (mAnchorStart)
+    {
+      if (!i0->IsPrefixOf(id))
+      {
+        return false;
+      }
+
+      id += i0->mLiteral.size();
+      ++i0;
+    }
+
+    if (mAnchorEnd && i0 != i1)
+    {
+      --i1;
+      idEnd -= i1->mLiteral.size();
+      if (idEnd < id || !i1->IsPrefixOf(idEnd))
+      {
+        return false;
+      }
+    }
+
+    while (i0 != i1)
+    {
+      id = i0->Find(id, idEnd);
+      if (!id)
+      {
+        return false;
+      }
+      ++i0;
+    }
+    return true;
+  }
+
+private:
+  struct Segment
+  {
+    std::string mLiteral;
+    std::vector<size_t> mFallback;  // KMP failure function.
+
+    Segment(char const* begin, char const* end)
+    : mLiteral(begin, end),
+      mFallback(mLiteral.size(), 0)
+    {
+      size_t k = 0;
+      for (size_t i = 1; i < mLiteral.size(); ++i)
+      {
+        while (k > 0 && mLiteral[i] != mLiteral[k])
+        {
+          k = mFallback[k - 1];
+        }
+
+        k += mLiteral[i] == mLiteral[k];
+        mFallback[i] = k;
+      }
+    }
+
+    bool IsPrefixOf(char const* id) const
+    {
+      return strncmp(id, mLiteral.c_str(), mLiteral.size()) == 0;
+    }
+
+    ///@return Pointer past the first occurrence of the literal in [ @a i, @a iEnd ),
+    /// nullptr if there was none.
+    char const* Find(char const* i, char const* iEnd) const
+    {
+      size_t k = 0;
+      while (i != iEnd)
+      {
+        while (k > 0 && *i != mLiteral[k])
+        {
+          k = mFallback[k - 1];
+        }
+
+        k += *i == mLiteral[k];
+        ++i;
+        if (k == mLiteral.size())
+        {
+          return i;
+        }
+      }
+      return nullptr;
+    }
+  };
+
+  std::vector<Segment> mSegments;
+  size_t mMinLength = 0;
+  bool mAnchorStart;
+  bool mAnchorEnd;
+  bool mHasWildcard;
+};
+
+std::vector<Filter> sIncludeFilters;
+std::vector<Filter> sExcludeFilters;
+
+///@brief Compiles the colon-delimited filters in [ @a i, @a iEnd ) into @a filters,
+/// ignoring the zero length ones.
+void CompileFilters(char const* i, char const* iEnd, std::vector<Filter>& filters)
+{
+  filters.clear();
+  while (i != iEnd)
+  {
+    auto subEnd = std::find(i, iEnd, ':');
+    if (subEnd != i)
+    {
+      filters.emplace_back(i, subEnd);
+    }
+
+    i = subEnd + (subEnd != iEnd);
+  }
+}
+
+///@return true if any of the @a filters have matched the id in the [ @a id, @a idEnd )
+/// range, false otherwise.
+bool FiltersMatch(std::vector<Filter> const& filters, char const* id, char const* idEnd)
+{
+  return std::any_of(filters.begin(), filters.end(), [id, idEnd](Filter const& f) {
+    return f.Match(id, idEnd);
+  });
+}
+
+///@return A hash of the id of the test of the given @a suite and @a name, which is
+/// stable across runs and platforms (64-bit FNV-1a).
+uint64_t HashId(char const* suite, char const* name)
+{
+  uint64_t hash = 14695981039346656037ull;
+  auto update = [&hash](char c) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+  };
+
+  while (*suite)
+  {
+    update(*suite++);
+  }
+
+  update(kJoinTestSuiteName);
+  while (*name)
+  {
+    update(*name++);
+  }
+  return hash;
+}
+
+///@brief Determines if the combination of the given @a suite and @a name (joined
+/// by a '_') is allowed through the filters.
+bool IsAllowed(char const* suite, char const* name)
+{
+  thread_local std::string id;
+  id.assign(suite).append(1, kJoinTestSuiteName).append(name);
+  auto idEnd = id.c_str() + id.size();
+  return (sIncludeFilters.empty() || FiltersMatch(sIncludeFilters, id.c_str(), idEnd)) &&
+    !FiltersMatch(sExcludeFilters, id.c_str(), idEnd);
+}
+
+// A std::streambuf that appends all output to a std::string.
+struct StringBuf : std::streambuf
+{
+  std::string mString;
+
+protected:
+  int_type overflow(int_type c) override
+  {
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+      mString.push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(char const* s, std::streamsize n) override
+  {
+    mString.append(s, size_t(n));
+    return n;
+  }
+};
+
+// Prints the progress of the tests to sOutput, in human readable form. Output is
+// collected in a buffer, which is only written and flushed on failure, at the end
+// of suites, once it's grown past kFlushSize, kFlushIntervalNs after the last
+// flush, or when the process crashes (see CrashFlush).
+class ConsoleReporter : public Reporter
+{
+public:
+  ConsoleReporter()
+  : mStream(&mBuffer)
+  {
+    mBuffer.mString.reserve(kFlushSize * 2);
+  }
+
+  ~ConsoleReporter()
+  {
+    Flush();
+  }
+
+  void OnSuiteStarted(char const* suite) override
+  {
+    mStream << "[" << kStatus[SUITE] << "] " << suite << '\n';
+  }
+
+  void OnTestStarted(char const* suite, char const* name) override
+  {
+    mStream << "[" << kStatus[STARTED] << "] " << suite << kJoinTestSuiteName << name << '\n';
+    Update();
+  }
+
+  void OnTestFinished(TestResult const& result) override
+  {
+    SetColor(uint16_t(result.passed ? FOREGROUND_GREEN : FOREGROUND_RED));
+    mStream << "[" << kStatus[result.passed] << "] " << result.suite << kJoinTestSuiteName <<
+      result.name << " (" << result.duration << "ms";
+    if (auto allocs = result.allocations)
+    {
+      PrintAllocations(*allocs);
+    }
+    if (auto counters = result.counters)
+    {
+      PrintCounters(*counters);
+    }
+    mStream << ")";
+    SetColor(FOREGROUND_RESET);
+    mStream << '\n';
+
+    if (result.benchmark)
+    {
+      PrintBenchmark(*result.benchmark);
+    }
+
+    if (auto usage = result.usage)
+    {
+      Rank(result, *usage);
+    }
+
+    if (!result.passed)
+    {
+      if (result.error)
+      {
+        mStream << result.error << '\n';
+      }
+      Flush();
+    }
+    else
+    {
+      Update();
+    }
+  }
+
+  void OnSuiteFinished(char const* /*suite*/) override
+  {
+    Flush();
+  }
+
+  void OnMessage(char const* message) override
+  {
+    mStream << "[" << kStatus[TALLY] << "] " << message << '\n';
+    Flush();
+  }
+
+  void OnRunFinished(Tally const& tally) override
+  {
+    mStream << "[" << kStatus[SUITE] << "]" << '\n';
+    mStream << "[" << kStatus[TALLY] << "] " << tally.run << " tests run." << '\n';
+    mStream << "[" << kStatus[TALLY] << "] " << tally.passed << " tests passed." << '\n';
+    if (tally.ignored > 0)
+    {
+      mStream << "[" << kStatus[TALLY] << "] " << tally.ignored << " tests ignored." << '\n';
+    }
+    PrintUsage();
+
+    const bool endResult = tally.passed == tally.run && tally.errors == 0;
+    SetColor(uint16_t(endResult ? FOREGROUND_GREEN : FOREGROUND_RED));
+    mStream << "[" << kStatus[endResult] << "] Final result.";
+    SetColor(FOREGROUND_RESET);
+    mStream << '\n';
+    Flush();
+  }
+
+  ///@brief Writes out the buffered output.
+  void Flush()
+  {
+    auto& buffer = mBuffer.mString;
+    if (!buffer.empty())
+    {
+      sOutput->write(buffer.data(), std::streamsize(buffer.size()));
+      buffer.clear();
+    }
+
+    sOutput->flush();
+    mLastFlushNs = NowNs();
+  }
+
+private:
+  static constexpr size_t kFlushSize = 1 << 16;
+  static constexpr int64_t kFlushIntervalNs = 100000000;
+
+  // A test among the slowest.
+  struct SlowTest
+  {
+    std::string id;
+    double duration;
+    ResourceUsage usage;
+  };
+
+  StringBuf mBuffer;
+  std::ostream mStream;
+  int64_t mLastFlushNs = NowNs();
+  std::vector<SlowTest> mSlowest; // the longest first, up to sSlowestCount.
+  std::string mMostMemoryId;  // of the test that has grown the peak RSS the most.
+  size_t mMostMemory = 0;
+
+  // Keeps track of whether the test of @a result is among the slowest, or has grown
+  // the peak RSS the most so far.
+  void Rank(TestResult const& result, ResourceUsage const& usage)
+  {
+    auto const makeId = [&result] {
+      return std::string(result.suite).append(1, kJoinTestSuiteName).append(result.name);
+    };
+
+    if (mSlowest.size() < sSlowestCount ||
+      (!mSlowest.empty() && result.duration > mSlowest.back().duration))
+    {
+      auto i = std::find_if(mSlowest.begin(), mSlowest.end(),
+        [&result](SlowTest const& slow) { return result.duration > slow.duration; });
+      mSlowest.insert(i, SlowTest{ makeId(), result.duration, usage });
+      if (mSlowest.size() > sSlowestCount)
+      {
+        mSlowest.pop_back();
+      }
+    }
+
+    if (usage.peakRssGrowth > mMostMemory)
+    {
+      mMostMemoryId = makeId();
+      mMostMemory = usage.peakRssGrowth;
+    }
+  }
+
+  void PrintUsage()
+  {
+    char buffer[128];
+    if (!mSlowest.empty())
+    {
+      mStream << "[" << kStatus[TALLY] << "] Slowest tests:" << '\n';
+      for (auto& slow : mSlowest)
+      {
+        snprintf(buffer, sizeof(buffer), ": %.6gms; CPU %.6gms user, %.6gms system",
+          slow.duration, slow.usage.userMs, slow.usage.systemMs);
+        mStream << "[" << kStatus[TALLY] << "]   " << slow.id << buffer << '\n';
+      }
+    }
+
+    FormatSi(double(SampleUsage().peakRss), buffer, sizeof(buffer));
+    mStream << "[" << kStatus[TALLY] << "] Peak RSS " << buffer << "B";
+    if (mMostMemory > 0)
+    {
+      FormatSi(double(mMostMemory), buffer, sizeof(buffer));
+      mStream << "; " << mMostMemoryId << " grew it the most, by " << buffer << "B";
+    }
+    mStream << "." << '\n';
+  }
+
+  void SetColor(uint16_t attribute)
+  {
+#ifdef _WIN32
+    Flush();  // Console attributes only apply to what's written after setting them.
+#endif
+    mStream << StreamColor{ attribute };
+  }
+
+  void PrintAllocations(AllocationStats const& allocs)
+  {
+    char bytes[32];
+    char peak[32];
+    FormatSi(double(allocs.bytes), bytes, sizeof(bytes));
+    FormatSi(double(allocs.peakBytes), peak, sizeof(peak));
+    mStream << ", " << allocs.count << " allocs, " << bytes << "B, peak " << peak << "B";
+    if (allocs.leakedBytes > 0)
+    {
+      mStream << ", LEAKED " << allocs.leakedBytes << "B";
+    }
+  }
+
+  void PrintCounters(PerfCounters const& counters)
+  {
+    char count[32];
+    for (auto& info : kPerfCounters)
+    {
+      if (counters.available & info.bit)
+      {
+        FormatSi(double(counters.*info.count), count, sizeof(count));
+        mStream << ", " << count << " " << info.name;
+      }
+    }
+  }
+
+  void PrintBenchmark(BenchmarkResult const& bench)
+  {
+    char rate[32];
+    double perSecond = 1e9 / bench.mean;
+    if (bench.bytesPerIteration > .0)
+    {
+      FormatSi(bench.bytesPerIteration * perSecond, rate, sizeof(rate));
+      strcat(rate, "B/s");
+    }
+    else
+    {
+      FormatSi(bench.itemsPerIteration * perSecond, rate, sizeof(rate));
+      strcat(rate, " items/s");
+    }
+
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%llu iterations x %zu samples; ns/iteration: "
+      "mean %.4g, median %.4g, stddev %.4g, min %.4g; %s",
+      static_cast<unsigned long long>(bench.iterations), bench.numSamples,
+      bench.mean, bench.median, bench.stddev, bench.min, rate);
+    mStream << "[" << kStatus[BENCH] << "] " << buffer << '\n';
+
+    auto& counters = bench.counters;
+    if (counters.available)
+    {
+      auto numIterations = double(bench.iterations) * double(bench.numSamples);
+      mStream << "[" << kStatus[BENCH] << "] per iteration:";
+      char const* separator = " ";
+      for (auto& info : kPerfCounters)
+      {
+        if (counters.available & info.bit)
+        {
+          snprintf(buffer, sizeof(buffer), "%s%.4g %s", separator,
+            double(counters.*info.count) / numIterations, info.name);
+          mStream << buffer;
+          separator = ", ";
+        }
+      }
+
+      auto const kIpc = PerfCounters::kCycles | PerfCounters::kInstructions;
+      if ((counters.available & kIpc) == kIpc && counters.cycles > 0)
+      {
+        snprintf(buffer, sizeof(buffer), "; IPC %.3g",
+          double(counters.instructions) / double(counters.cycles));
+        mStream << buffer;
+      }
+      mStream << '\n';
+    }
+  }
+
+  void Update()
+  {
+    if (mBuffer.mString.size() >= kFlushSize || NowNs() - mLastFlushNs >= kFlushIntervalNs)
+    {
+      Flush();
+    }
+  }
+};
+
+// The console reporter of the current run. Should the process crash, its buffered
+// output is written first, so that the test that was running is shown.
+std::atomic<ConsoleReporter*> sCrashReporter{ nullptr };
+
+constexpr int kCrashSignals[] = {
+  SIGSEGV,
+  SIGABRT,
+  SIGFPE,
+  SIGILL,
+#ifndef _WIN32
+  SIGBUS,
+#endif
+};
+
+void FlushOnCrash(int signal)
+{
+  std::signal(signal, SIG_DFL);
+  if (auto reporter = sCrashReporter.exchange(nullptr))
+  {
+    reporter->Flush(); // not async-signal-safe, but the process is going down anyway.
+  }
+  std::raise(signal);
+}
+
+// Installs FlushOnCrash() for the crash signals, for the lifetime of the object, if
+// there's a @a reporter.
+class CrashFlush
+{
+public:
+  explicit CrashFlush(ConsoleReporter* reporter)
+  : mInstalled(reporter != nullptr)
+  {
+    if (mInstalled)
+    {
+      sCrashReporter = reporter;
+      for (size_t i = 0; i < std::size(kCrashSignals); ++i)
+      {
+        mHandlers[i] = std::signal(kCrashSignals[i], FlushOnCrash);
+      }
+    }
+  }
+
+  ~CrashFlush()
+  {
+    if (mInstalled)
+    {
+      for (size_t i = 0; i < std::size(kCrashSignals); ++i)
+      {
+        std::signal(kCrashSignals[i], mHandlers[i] == SIG_ERR ? SIG_DFL : mHandlers[i]);
+      }
+      sCrashReporter = nullptr;
+    }
+  }
+
+private:
+  using Handler = void(*)(int);
+
+  bool mInstalled;
+  Handler mHandlers[std::size(kCrashSignals)];
+
+  CrashFlush(CrashFlush const&) = delete;
+  CrashFlush& operator=(CrashFlush const&) = delete;
+};
+
+// Writes @a str to @a os, escaped for use in XML attribute values.
+void WriteXmlEscaped(std::ostream& os, char const* str)
+{
+  while (*str)
+  {
+    auto c = *str;
+    switch (c)
+    {
+    case '&': os << "&amp;"; break;
+    case '<': os << "&lt;"; break;
+    case '>': os << "&gt;"; break;
+    case '"': os << "&quot;"; break;
+    case '\'': os << "&apos;"; break;
+    case '\n': os << "&#10;"; break;
+    default:
+      if (static_cast<unsigned char>(c) >= 0x20 || c == '\t')
+      {
+        os.put(c);
+      }
+      break;
+    }
+    ++str;
+  }
+}
+
+// Writes @a str to @a os as a double quoted JSON string (which is also valid YAML).
+void WriteJsonString(std::ostream& os, char const* str)
+{
+  os.put('"');
+  while (*str)
+  {
+    auto c = *str;
+    switch (c)
+    {
+    case '"': os << "\\\""; break;
+    case '\\': os << "\\\\"; break;
+    case '\n': os << "\\n"; break;
+    case '\t': os << "\\t"; break;
+    case '\r': os << "\\r"; break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20)
+      {
+        char buffer[8];
+        snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+        os << buffer;
+      }
+      else
+      {
+        os.put(c);
+      }
+      break;
+    }
+    ++str;
+  }
+  os.put('"');
+}
+
+// Streams results as JUnit XML. As the totals aren't known until the end, the
+// testsuite elements don't carry tests / failures counts.
+class JUnitReporter : public Reporter
+{
+public:
+  explicit JUnitReporter(std::ostream& os)
+  : mStream(os)
+  {}
+
+  void OnRunStarted(size_t /*numTests*/) override
+  {
+    mStream << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n";
+  }
+
+  void OnSuiteStarted(char const* suite) override
+  {
+    mStream << "  <testsuite name=\"";
+    WriteXmlEscaped(mStream, suite);
+    mStream << "\">\n";
+  }
+
+  void OnTestFinished(TestResult const& result) override
+  {
+    mStream << "    <testcase classname=\"";
+    WriteXmlEscaped(mStream, result.suite);
+    mStream << "\" name=\"";
+    WriteXmlEscaped(mStream, result.name);
+    mStream << "\" time=\"" << result.duration * .001 << "\" assertions=\"" <<
+      result.assertions << "\"";
+    if (result.passed && !result.counters)
+    {
+      mStream << "/>\n";
+      return;
+    }
+
+    mStream << ">\n";
+    if (auto counters = result.counters)
+    {
+      mStream << "      <properties>\n";
+      for (auto& info : kPerfCounters)
+      {
+        if (counters->available & info.bit)
+        {
+          mStream << "        <property name=\"" << info.key << "\" value=\"" <<
+            counters->*info.count << "\"/>\n";
+        }
+      }
+      mStream << "      </properties>\n";
+    }
+
+    if (!result.passed)
+    {
+      mStream << "      <failure message=\"";
+      WriteXmlEscaped(mStream, result.error ? result.error : "");
+      mStream << "\"/>\n";
+    }
+    mStream << "    </testcase>\n";
+  }
+
+  void OnSuiteFinished(char const* /*suite*/) override
+  {
+    mStream << "  </testsuite>\n";
+    mStream.flush();
+  }
+
+  void OnRunFinished(Tally const& /*tally*/) override
+  {
+    mStream << "</testsuites>\n";
+    mStream.flush();
+  }
+
+private:
+  std::ostream& mStream;
+};
+
+// Streams results as JSON Lines: an object per test, and one for the tally.
+class JsonLinesReporter : public Reporter
+{
+public:
+  explicit JsonLinesReporter(std::ostream& os)
+  : mStream(os)
+  {}
+
+  void OnTestFinished(TestResult const& result) override
+  {
+    mStream << "{\"type\":\"test\",\"suite\":";
+    WriteJsonString(mStream, result.suite);
+    mStream << ",\"name\":";
+    WriteJsonString(mStream, result.name);
+    mStream << ",\"status\":\"" << (result.passed ? "passed" : "failed") <<
+      "\",\"duration_ms\":" << result.duration << ",\"assertions\":" << result.assertions;
+    if (auto usage = result.usage)
+    {
+      mStream << ",\"cpu_user_ms\":" << usage->userMs << ",\"cpu_system_ms\":" <<
+        usage->systemMs << ",\"peak_rss_growth_bytes\":" << usage->peakRssGrowth;
+    }
+    if (result.error)
+    {
+      mStream << ",\"error\":";
+      WriteJsonString(mStream, result.error);
+    }
+
+    if (auto bench = result.benchmark)
+    {
+      mStream << ",\"benchmark\":{\"iterations\":" << bench->iterations <<
+        ",\"samples\":" << bench->numSamples << ",\"mean_ns\":" << bench->mean <<
+        ",\"median_ns\":" << bench->median << ",\"stddev_ns\":" << bench->stddev <<
+        ",\"min_ns\":" << bench->min << ",\"items_per_iteration\":" <<
+        bench->itemsPerIteration << ",\"bytes_per_iteration\":" << bench->bytesPerIteration;
+      if (bench->counters.available)
+      {
+        mStream << ",\"counters_per_iteration\":";
+        WriteCounters(bench->counters, double(bench->iterations) * double(bench->numSamples));
+      }
+      mStream << "}";
+    }
+
+    if (auto allocs = result.allocations)
+    {
+      mStream << ",\"allocations\":{\"count\":" << allocs->count << ",\"bytes\":" <<
+        allocs->bytes << ",\"peak_bytes\":" << allocs->peakBytes << ",\"leaked_bytes\":" <<
+        allocs->leakedBytes << "}";
+    }
+
+    if (auto counters = result.counters)
+    {
+      mStream << ",\"counters\":";
+      WriteCounters(*counters, .0);
+    }
+    mStream << "}\n";
+  }
+
+  void OnSuiteFinished(char const* /*suite*/) override
+  {
+    mStream.flush();
+  }
+
+  void OnRunFinished(Tally const& tally) override
+  {
+    mStream << "{\"type\":\"tally\",\"run\":" << tally.run << ",\"passed\":" <<
+      tally.passed << ",\"ignored\":" << tally.ignored << ",\"errors\":" << tally.errors <<
+      "}\n";
+    mStream.flush();
+  }
+
+private:
+  std::ostream& mStream;
+
+  // Writes the available @a counters as an object - per iteration, unless
+  // @a numIterations is 0.
+  void WriteCounters(PerfCounters const& counters, double numIterations)
+  {
+    char const* separator = "{";
+    for (auto& info : kPerfCounters)
+    {
+      if (counters.available & info.bit)
+      {
+        mStream << separator << "\"" << info.key << "\":";
+        if (numIterations > .0)
+        {
+          mStream << double(counters.*info.count) / numIterations;
+        }
+        else
+        {
+          mStream << counters.*info.count;
+        }
+        separator = ",";
+      }
+    }
+    mStream << "}";
+  }
+};
+
+// Streams results in the Test Anything Protocol (version 13), with the details
+// of failures in YAML blocks.
+class TapReporter : public Reporter
+{
+public:
+  explicit TapReporter(std::ostream& os)
+  : mStream(os)
+  {}
+
+  void OnRunStarted(size_t numTests) override
+  {
+    mStream << "TAP version 13\n1.." << numTests << "\n";
+  }
+
+  void OnSuiteStarted(char const* suite) override
+  {
+    mStream << "# " << suite << "\n";
+  }
+
+  void OnTestFinished(TestResult const& result) override
+  {
+    ++mNumber;
+    mStream << (result.passed ? "ok " : "not ok ") << mNumber << " - " << result.suite <<
+      kJoinTestSuiteName << result.name << "\n";
+    if (!result.passed)
+    {
+      mStream << "  ---\n  message: ";
+      WriteJsonString(mStream, result.error ? result.error : "");
+      mStream << "\n  duration_ms: " << result.duration << "\n  assertions: " <<
+        result.assertions << "\n  ...\n";
+    }
+  }
+
+  void OnSuiteFinished(char const* /*suite*/) override
+  {
+    mStream.flush();
+  }
+
+  void OnRunFinished(Tally const& /*tally*/) override
+  {
+    mStream.flush();
+  }
+
+private:
+  std::ostream& mStream;
+  size_t mNumber = 0;
+};
+
+// Forwards events to any number of reporters, one at a time.
+class MultiReporter : public Reporter
+{
+public:
+  void Add(Reporter& reporter)
+  {
+    mReporters.push_back(&reporter);
+  }
+
+  ///@brief Stops events from being reported, waiting up to @a timeout for the one in
+  /// progress (if any), e.g. as the process is about to be aborted from another thread.
+  ///@return Whether it has; if so, reporting remains locked.
+  bool Lock(sc::milliseconds timeout)
+  {
+    return mMutex.try_lock_for(timeout);
+  }
+
+  void OnRunStarted(size_t numTests) override
+  {
+    std::lock_guard<std::timed_mutex> lock(mMutex);
+    for (auto r : mReporters)
+    {
+      r->OnRunStarted(numTests);
+    }
+  }
+
+  void OnSuiteStarted(char const* suite) override
+  {
+    std::lock_guard<std::timed_mutex> lock(mMutex);
+    for (auto r : mReporters)
+    {
+      r->OnSuiteStarted(suite);
+    }
+  }
+
+  void OnTestStarted(char const* suite, char const* name) override
+  {
+    std::lock_guard<std::timed_mutex> lock(mMutex);
+    for (auto r : mReporters)
+    {
+      r->OnTestStarted(suite, name);
+    }
+  }
+
+  void OnTestFinished(TestResult const& result) override
+  {
+    std::lock_guard<std::timed_mutex> lock(mMutex);
+    for (auto r : mReporters)
+    {
+      r->OnTestFinished(result);
+    }
+  }
+
+  void OnSuiteFinished(char const* suite) override
+  {
+    std::lock_guard<std::timed_mutex> lock(mMutex);
+    for (auto r : mReporters)
+    {
+      r->OnSuiteFinished(suite);
+    }
+  }
+
+  void OnMessage(char const* message) override
+  {
+    std::lock_guard<std::timed_mutex> lock(mMutex);
+    for (auto r : mReporters)
+    {
+      r->OnMessage(message);
+    }
+  }
+
+  void OnRunFinished(Tally const& tally) override
+  {
+    std::lock_guard<std::timed_mutex> lock(mMutex);
+    for (auto r : mReporters)
+    {
+      r->OnRunFinished(tally);
+    }
+  }
+
+private:
+  std::vector<Reporter*> mReporters;
+  std::timed_mutex mMutex;
+};
+
+Reporter* sReporter = nullptr;
+std::vector<Reporter*> sExtraReporters;
+std::string sReportFiles[3];  // by ReportFormat
+
+} // nonamespace
+
+void SetOutput(std::ostream& out)
+{
+  sOutput = &out;
+#ifdef _WIN32
+  sOutputHandle =
+    (&out == &std::cout) ? GetStdHandle(STD_OUTPUT_HANDLE) :
+    (&out == &std::cerr) ? GetStdHandle(STD_ERROR_HANDLE) :
+    nullptr;
+#endif
+}
+
+void SetMessageLimit(size_t bytes)
+{
+  sMessageLimit = bytes;
+}
+
+void SetMaxBytesPrinted(size_t bytes)
+{
+  sMaxBytesPrinted = bytes;
+}
+
+void SetReporter(Reporter* reporter)
+{
+  sReporter = reporter;
+}
+
+Reporter::~Reporter() = default;
+
+void AddReporter(Reporter& reporter)
+{
+  sExtraReporters.push_back(&reporter);
+}
+
+void SetReportFile(ReportFormat format, char const* path)
+{
+  sReportFiles[static_cast<int>(format)].assign(path ? path : "");
+}
+
+void SetFilter(char const* filterStr)
+{
+  sIncludeFilters.clear();
+  sExcludeFilters.clear();
+  if (filterStr)
+  {
+    auto negative = filterStr + strcspn(filterStr, "-");
+    CompileFilters(filterStr, negative, sIncludeFilters);
+
+    if (*negative == '-')
+    {
+      ++negative;
+      CompileFilters(negative, negative + strlen(negative), sExcludeFilters);
+    }
+  }
+}
+
+void SetConcurrency(unsigned int numThreads)
+{
+  sConcurrencySet = true;
+  sConcurrency = numThreads;
+}
+
+void SetIsolation(bool isolate)
+{
+  sIsolation = isolate;
+}
+
+void SetPerfCounters(bool enable)
+{
+  sPerfCounters = enable;
+}
+
+void SetTraceFile(char const* path)
+{
+  sTraceFile.assign(path ? path : "");
+}
+
+void SetShard(unsigned int index, unsigned int count)
+{
+  sShardSet = true;
+  sShardIndex = index;
+  sShardCount = count;
+}
+
+void SetShardSummary(char const* path)
+{
+  sShardSummarySet = true;
+  sShardSummary.assign(path ? path : "");
+}
+
+void SetTimingCache(char const* path)
+{
+  sTimingCache.assign(path ? path : "");
+}
+
+void SetSlowestCount(unsigned int count)
+{
+  sSlowestCount = count;
+}
+
+void SetFailFast(bool failFast)
+{
+  sFailFast = failFast;
+}
+
+void SetListOnly(bool listOnly)
+{
+  sListOnly = listOnly;
+}
+
+void SetRepeat(unsigned int count)
+{
+  sRepeatCount = count;
+}
+
+void SetUntilFail(bool untilFail)
+{
+  sUntilFail = untilFail;
+}
+
+void SetShuffle(bool shuffle, uint64_t seed)
+{
+  sShuffle = shuffle;
+  sShuffleSeed = seed;
+}
+
+void SetDefaultTimeout(double milliseconds)
+{
+  sDefaultTimeout = std::max(milliseconds, .0);
+}
+
+void SetRerunMode(RerunMode mode)
+{
+  sRerunMode = mode;
+}
+
+void SetBenchmarkTime(double milliseconds)
+{
+  sBenchmarkTime = std::max(milliseconds, .0);
+}
+
+void SetBenchmarkSamples(unsigned int samples)
+{
+  sBenchmarkSamples = std::max(samples, 1u);
+}
+
+void SetBenchmarkBaseline(char const* path)
+{
+  sBenchmarkBaseline.assign(path ? path : "");
+}
+
+void SetBenchmarkRecord(char const* path)
+{
+  sBenchmarkRecord.assign(path ? path : "");
+}
+
+void SetBenchmarkThreshold(double ratio)
+{
+  sBenchmarkThreshold = std::max(ratio, .0);
+}
+
+void SetPropertyCases(unsigned int cases)
+{
+  sPropertyCases = cases;
+}
+
+void SetPropertySeed(uint64_t seed)
+{
+  sPropertySeed = seed;
+}
+
+void SetPropertyThreads(unsigned int numThreads)
+{
+  sPropertyThreads = numThreads;
+}
+
+void ParseArgs(int argc, char const* const* argv)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    char const* arg = argv[i];
+    char const* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (strcmp(arg, "--filter") == 0 && value)
+    {
+      SetFilter(value);
+      ++i;
+    }
+    else if ((strcmp(arg, "--jobs") == 0 || strcmp(arg, "-j") == 0) && value)
+    {
+      SetConcurrency(static_cast<unsigned int>(strtoul(value, nullptr, 10)));
+      ++i;
+    }
+    else if (strcmp(arg, "--isolate") == 0)
+    {
+      SetIsolation(true);
+    }
+    else if (strcmp(arg, "--perf-counters") == 0)
+    {
+      SetPerfCounters(true);
+    }
+    else if (strcmp(arg, "--trace") == 0 && value)
+    {
+      SetTraceFile(value);
+      ++i;
+    }
+    else if (strcmp(arg, "--shard") == 0 && value)
+    {
+      char* count;
+      auto index = strtoul(value, &count, 10);
+      if (*count == '/')
+      {
+        SetShard(static_cast<unsigned int>(index),
+          static_cast<unsigned int>(strtoul(count + 1, nullptr, 10)));
+      }
+      ++i;
+    }
+    else if (strcmp(arg, "--shard-summary") == 0 && value)
+    {
+      SetShardSummary(value);
+      ++i;
+    }
+    else if (strcmp(arg, "--timing-cache") == 0 && value)
+    {
+      SetTimingCache(value);
+      ++i;
+    }
+    else if (strcmp(arg, "--fail-fast") == 0)
+    {
+      SetFailFast(true);
+    }
+    else if (strcmp(arg, "--slowest") == 0 && value)
+    {
+      SetSlowestCount(static_cast<unsigned int>(strtoul(value, nullptr, 10)));
+      ++i;
+    }
+    else if (strcmp(arg, "--list") == 0)
+    {
+      SetListOnly(true);
+    }
+    else if (strcmp(arg, "--repeat") == 0 && value)
+    {
+      SetRepeat(static_cast<unsigned int>(strtoul(value, nullptr, 10)));
+      ++i;
+    }
+    else if (strcmp(arg, "--until-fail") == 0)
+    {
+      SetUntilFail(true);
+    }
+    else if (strcmp(arg, "--shuffle") == 0)
+    {
+      SetShuffle(true, sShuffleSeed);
+    }
+    else if (strcmp(arg, "--shuffle-seed") == 0 && value)
+    {
+      SetShuffle(true, strtoull(value, nullptr, 10));
+      ++i;
+    }
+    else if (strcmp(arg, "--timeout") == 0 && value)
+    {
+      SetDefaultTimeout(strtod(value, nullptr));
+      ++i;
+    }
+    else if (strcmp(arg, "--failed-first") == 0)
+    {
+      SetRerunMode(RerunMode::kFailedFirst);
+    }
+    else if (strcmp(arg, "--failed-only") == 0)
+    {
+      SetRerunMode(RerunMode::kFailedOnly);
+    }
+    else if (strcmp(arg, "--junit") == 0 && value)
+    {
+      SetReportFile(ReportFormat::kJUnitXml, value);
+      ++i;
+    }
+    else if (strcmp(arg, "--jsonl") == 0 && value)
+    {
+      SetReportFile(ReportFormat::kJsonLines, value);
+      ++i;
+    }
+    else if (strcmp(arg, "--tap") == 0 && value)
+    {
+      SetReportFile(ReportFormat::kTap, value);
+      ++i;
+    }
+    else if (strcmp(arg, "--bench-time") == 0 && value)
+    {
+      SetBenchmarkTime(strtod(value, nullptr));
+      ++i;
+    }
+    else if (strcmp(arg, "--bench-samples") == 0 && value)
+    {
+      SetBenchmarkSamples(static_cast<unsigned int>(strtoul(value, nullptr, 10)));
+      ++i;
+    }
+    else if (strcmp(arg, "--bench-baseline") == 0 && value)
+    {
+      SetBenchmarkBaseline(value);
+      ++i;
+    }
+    else if (strcmp(arg, "--bench-record") == 0 && value)
+    {
+      SetBenchmarkRecord(value);
+      ++i;
+    }
+    else if (strcmp(arg, "--bench-threshold") == 0 && value)
+    {
+      SetBenchmarkThreshold(strtod(value, nullptr) / 100.);
+      ++i;
+    }
+    else if (strcmp(arg, "--property-cases") == 0 && value)
+    {
+      SetPropertyCases(static_cast<unsigned int>(strtoul(value, nullptr, 10)));
+      ++i;
+    }
+    else if (strcmp(arg, "--seed") == 0 && value)
+    {
+      SetPropertySeed(strtoull(value, nullptr, 10));
+      ++i;
+    }
+    else if (strcmp(arg, "--property-threads") == 0 && value)
+    {
+      SetPropertyThreads(static_cast<unsigned int>(strtoul(value, nullptr, 10)));
+      ++i;
+    }
+  }
+}
+
+namespace detail
+{
+
+// Collects the failures recorded by the other threads that a test spawns - see
+// ThreadGuard -, which are appended without locking.
+class TestContext
+{
+public:
+  TestContext() = default;
+
+  ~TestContext()
+  {
+    std::string discard;
+    AppendTo(discard);
+  }
+
+  void Add(char const* message)
+  {
+    AllocationPause pause;
+    auto size = strlen(message);
+    auto record = reinterpret_cast<Record*>(new char[sizeof(Record) + size + 1]);
+    record->size = size;
+    memcpy(record + 1, message, size + 1);
+
+    record->next = mHead.load(std::memory_order_relaxed);
+    while (!mHead.compare_exchange_weak(record->next, record, std::memory_order_release,
+      std::memory_order_relaxed))
+    {}
+  }
+
+  void AddAssertions(size_t count)
+  {
+    mAssertions.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  size_t GetAssertions() const
+  {
+    return mAssertions.load(std::memory_order_relaxed);
+  }
+
+  bool HasFailures() const
+  {
+    return mHead.load(std::memory_order_acquire) != nullptr;
+  }
+
+  ///@brief Appends the messages to @a str in the order they were added, each on a line
+  /// of its own, and removes them.
+  void AppendTo(std::string& str)
+  {
+    // Reverse the stack first.
+    Record* first = nullptr;
+    auto record = mHead.exchange(nullptr, std::memory_order_acquire);
+    while (record)
+    {
+      auto next = record->next;
+      record->next = first;
+      first = record;
+      record = next;
+    }
+
+    while (first)
+    {
+      if (!str.empty())
+      {
+        str.append(1, '\n');
+      }
+      str.append(reinterpret_cast<char const*>(first + 1), first->size);
+
+      auto next = first->next;
+      AllocationPause pause;
+      delete[] reinterpret_cast<char*>(first);
+      first = next;
+    }
+  }
+
+private:
+  struct Record
+  {
+    Record* next;
+    size_t size;
+  };
+
+  std::atomic<Record*> mHead{ nullptr };
+  std::atomic<size_t> mAssertions{ 0 };
+
+  TestContext(TestContext const&) = delete;
+  TestContext& operator=(TestContext const&) = delete;
+};
+
+///@brief Orders @a descriptors as the tests were declared. Within a section, the
+/// linker keeps the translation units in order, but not necessarily the tests of each;
+/// the files are ordered as their first test appears, and the tests of each file by line.
+void OrderByDeclaration(std::vector<TestDescriptor const*>& descriptors)
+{
+  struct FileLess
+  {
+    bool operator()(char const* a, char const* b) const
+    {
+      return strcmp(a, b) < 0;
+    }
+  };
+
+  std::map<char const*, size_t, FileLess> files;
+  for (auto d : descriptors)
+  {
+    files.insert({ d->file, files.size() });
+  }
+
+  std::stable_sort(descriptors.begin(), descriptors.end(),
+    [&files](TestDescriptor const* a, TestDescriptor const* b) {
+      auto fileA = files[a->file];
+      auto fileB = files[b->file];
+      return fileA < fileB || (fileA == fileB && a->line < b->line);
+    });
+}
+
+///@return The descriptors of the registered tests, in the order of their declaration.
+std::vector<TestDescriptor const*> const& GetRegistry()
+{
+  static auto const registry = []() {
+    std::vector<TestDescriptor const*> descriptors;
+#if defined XM_DETAIL_USE_SECTION
+    if (__start_xm_tests && __stop_xm_tests)
+    {
+      descriptors.assign(__start_xm_tests, __stop_xm_tests);
+    }
+#else
+    for (auto r = sFirstRegistration; r; r = r->mNext)
+    {
+      descriptors.push_back(&r->mDescriptor);
+    }
+#endif
+    OrderByDeclaration(descriptors);
+    return descriptors;
+  }();
+  return registry;
+}
+
+// Runs the tests that were allowed through the filters - either on the calling
+// thread or spread across a pool of work stealing workers -, and reports their
+// results in the order of declaration.
+struct Runner
+{
+  // The indices of the groups of tests that a worker is yet to run. The owner takes
+  // work from the front, others steal from the back.
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<size_t> indices;
+  };
+
+#ifndef _WIN32
+  // A forked copy of the process, which runs the tests that it's sent the index of,
+  // and sends their results back, through a pair of pipes. If it crashes, the test
+  // it was running is failed, and a new child is forked for the next one.
+  class Isolate
+  {
+  public:
+    explicit Isolate(Runner& runner)
+    : mRunner(runner)
+    {}
+
+    ~Isolate()
+    {
+      Stop();
+    }
+
+    void Prefork()
+    {
+      if (mPid < 0)
+      {
+        Start();
+      }
+    }
+
+    void Run(size_t index, Result& result)
+    {
+      if (mPid < 0 && !Start())
+      {
+        result.passed = false;
+        result.error.assign("Failed to start an isolated process.");
+        return;
+      }
+
+      Clock clock;
+      uint32_t size;
+      std::string data;
+      bool received = WriteAll(mToChild, &index, sizeof(index)) &&
+        ReadAll(mFromChild, &size, sizeof(size));
+      if (received)
+      {
+        data.resize(size);
+        received = ReadAll(mFromChild, &data[0], size);
+      }
+
+      Unpacker unpacker{ data.data(), data.data() + data.size() };
+      if (!received || !Unpack(unpacker, result))
+      {
+        result = Result();
+        result.duration = clock.Measure();
+        result.error = DescribeExit(Stop());
+      }
+    }
+
+    ///@brief Kills the child process, if any, e.g. when the test it's running has
+    /// timed out. Safe to call from any thread.
+    bool Kill()
+    {
+      std::lock_guard<std::mutex> lock(mPidMutex);
+      return mPid > 0 && kill(mPid, SIGKILL) == 0;
+    }
+
+  private:
+    Runner& mRunner;
+    pid_t mPid = -1;
+    std::mutex mPidMutex; // for Kill()ing the child as it's being reaped.
+    int mToChild = -1;
+    int mFromChild = -1;
+
+    bool Start()
+    {
+      std::lock_guard<std::mutex> lock(sIsolatesMutex);
+      int toChild[2];
+      int fromChild[2];
+      if (pipe(toChild) != 0)
+      {
+        return false;
+      }
+
+      if (pipe(fromChild) != 0)
+      {
+        close(toChild[0]);
+        close(toChild[1]);
+        return false;
+      }
+
+      // Anything still buffered would be written by the child as well.
+      sOutput->flush();
+      fflush(nullptr);
+
+      mPid = fork();
+      if (mPid == 0)
+      {
+        sCrashReporter = nullptr; // its buffer is the parent's to write.
+        for (auto fd : sIsolateFds)
+        {
+          close(fd);
+        }
+        close(toChild[1]);
+        close(fromChild[0]);
+        Serve(toChild[0], fromChild[1]);
+      }
+
+      close(toChild[0]);
+      close(fromChild[1]);
+      if (mPid < 0)
+      {
+        close(toChild[1]);
+        close(fromChild[0]);
+        return false;
+      }
+
+      mToChild = toChild[1];
+      mFromChild = fromChild[0];
+      sIsolateFds.push_back(mToChild);
+      sIsolateFds.push_back(mFromChild);
+      return true;
+    }
+
+    ///@brief Closes the pipes to the child, and waits for it to exit.
+    ///@return The status of the child, as reported by waitpid().
+    int Stop()
+    {
+      int status = 0;
+      if (mPid > 0)
+      {
+        {
+          std::lock_guard<std::mutex> lock(sIsolatesMutex);
+          sIsolateFds.erase(std::remove_if(sIsolateFds.begin(), sIsolateFds.end(),
+            [this](int fd) { return fd == mToChild || fd == mFromChild; }), sIsolateFds.end());
+        }
+
+        close(mToChild);
+        close(mFromChild);
+        std::lock_guard<std::mutex> lock(mPidMutex);
+        while (waitpid(mPid, &status, 0) < 0 && errno == EINTR)
+        {}
+        mPid = -1;
+      }
+      return status;
+    }
+
+    ///@brief The loop of the child process; runs tests until the parent closes the pipe.
+    [[noreturn]] void Serve(int in, int out)
+    {
+      size_t index;
+      Packer packer;
+      while (ReadAll(in, &index, sizeof(index)))
+      {
+        Result result;
+        mRunner.RunTest(*mRunner.mTests[index], result);
+        std::cout.flush();
+        fflush(nullptr);
+
+        packer.mData.assign(sizeof(uint32_t), '\0');
+        Pack(result, packer);
+        auto size = uint32_t(packer.mData.size() - sizeof(uint32_t));
+        memcpy(&packer.mData[0], &size, sizeof(size));
+        if (!WriteAll(out, packer.mData.data(), packer.mData.size()))
+        {
+          break;
+        }
+      }
+
+      // Skip static destructors and atexit handlers; they belong to the parent.
+      _exit(0);
+    }
+  };
+#else
+  // Process isolation is not supported on Windows; tests are run in-process.
+  class Isolate
+  {
+  public:
+    explicit Isolate(Runner& runner)
+    : mRunner(runner)
+    {}
+
+    void Prefork()
+    {}
+
+    void Run(size_t index, Result& result)
+    {
+      mRunner.RunTest(*mRunner.mTests[index], result);
+    }
+
+    bool Kill()
+    {
+      return false;
+    }
+
+  private:
+    Runner& mRunner;
+  };
+#endif
+
+  // Watches the tests in progress from a thread of its own, and deals with the ones
+  // that exceed their timeout: isolated ones are killed, otherwise the process is
+  // aborted.
+  class Watchdog
+  {
+  public:
+    explicit Watchdog(Runner& runner)
+    : mRunner(runner),
+      mThread([this] { Loop(); })
+    {}
+
+    ~Watchdog()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+      }
+      mCondition.notify_all();
+      mThread.join();
+    }
+
+    ///@brief Starts watching the test at @a index, under @a id, which is unique among
+    /// the tests in progress.
+    void Watch(size_t id, size_t index, Isolate* isolate)
+    {
+      auto timeout = mRunner.mTests[index]->mTimeout;
+      if (timeout > .0)
+      {
+        auto now = NowNs();
+        {
+          std::lock_guard<std::mutex> lock(mMutex);
+          mWatches[id] = Entry{ index, now, now + int64_t(timeout * 1e6), isolate, std::string() };
+        }
+        mCondition.notify_all();
+      }
+    }
+
+    ///@return The report of the test watched under @a id having timed out - its
+    /// isolate was killed -, or an empty string if it didn't.
+    std::string Unwatch(size_t id)
+    {
+      std::string report;
+      std::lock_guard<std::mutex> lock(mMutex);
+      auto iFind = mWatches.find(id);
+      if (iFind != mWatches.end())
+      {
+        report.swap(iFind->second.report);
+        mWatches.erase(iFind);
+      }
+      return report;
+    }
+
+  private:
+    struct Entry
+    {
+      size_t index;  // into mTests
+      int64_t startNs;
+      int64_t deadlineNs;
+      Isolate* isolate;
+      std::string report; // once timed out
+    };
+
+    Runner& mRunner;
+    int64_t mStartNs = NowNs();
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::map<size_t, Entry> mWatches; // by id
+    bool mQuit = false;
+    std::thread mThread;
+
+    void Loop()
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      while (!mQuit)
+      {
+        auto now = NowNs();
+        auto next = INT64_MAX;
+        for (auto& watch : mWatches)
+        {
+          auto& entry = watch.second;
+          if (!entry.report.empty())
+          {
+            continue;
+          }
+
+          if (entry.deadlineNs <= now)
+          {
+            Expire(watch.first, entry, now);
+          }
+          else
+          {
+            next = std::min(next, entry.deadlineNs);
+          }
+        }
+
+        if (next == INT64_MAX)
+        {
+          mCondition.wait(lock);
+        }
+        else
+        {
+          mCondition.wait_for(lock, sc::nanoseconds(next - now));
+        }
+      }
+    }
+
+    void Expire(size_t id, Entry& entry, int64_t now)
+    {
+      auto& test = *mRunner.mTests[entry.index];
+      char buffer[128];
+      snprintf(buffer, sizeof(buffer), " timed out after %.6gms (timeout: %.6gms), %.6gms into the run",
+        (now - entry.startNs) / 1e6, test.mTimeout, (now - mStartNs) / 1e6);
+      auto report = MakeId(test).append(buffer);
+
+      bool others = false;
+      for (auto& watch : mWatches)
+      {
+        if (watch.first != id)
+        {
+          snprintf(buffer, sizeof(buffer), " (%.6gms)", (now - watch.second.startNs) / 1e6);
+          report.append(others ? ", " : "; also in progress: ").
+            append(MakeId(*mRunner.mTests[watch.second.index])).append(buffer);
+          others = true;
+        }
+      }
+      report.append(1, '.');
+
+      if (entry.isolate && entry.isolate->Kill())
+      {
+        entry.report.swap(report);
+      }
+      else
+      {
+        fprintf(stderr, "%s Aborting.\n", report.c_str());
+        fflush(stderr);
+        mRunner.FlushReports();
+        std::abort();
+      }
+    }
+  };
+
+  ///@brief Calls @a allowed with each registered test that passes the filters, in the
+  /// order of declaration, and @a ignored for each of the rest. Tests are created as
+  /// they pass; groups, to find out about their tests.
+  template <typename AllowedFn, typename IgnoredFn>
+  static void ForEachAllowed(AllowedFn allowed, IgnoredFn ignored)
+  {
+    for (auto d : GetRegistry())
+    {
+      if (!d->isGroup && !IsAllowed(d->suite, d->name))
+      {
+        ignored();
+        continue;
+      }
+
+      auto& test = d->create();
+      for (size_t i = 0, n = test.GetNumInstances(); i < n; ++i)
+      {
+        auto& instance = test.GetInstance(i);
+        if (IsAllowed(instance.mSuite, instance.mName))
+        {
+          allowed(instance);
+        }
+        else
+        {
+          ignored();
+        }
+      }
+    }
+  }
+
+  ///@brief Prints the ids of the tests that pass the filters; see SetListOnly().
+  static int List()
+  {
+    ForEachAllowed([](Test& test) {
+      *sOutput << test.mSuite << kJoinTestSuiteName << test.mName << "\n";
+    }, []() {});
+    sOutput->flush();
+    return 0;
+  }
+
+  Runner()
+  {
+    if (!sShardSet)
+    {
+      auto index = getenv("XM_SHARD_INDEX");
+      auto count = getenv("XM_SHARD_COUNT");
+      if (index && count)
+      {
+        sShardIndex = static_cast<unsigned int>(strtoul(index, nullptr, 10));
+        sShardCount = static_cast<unsigned int>(strtoul(count, nullptr, 10));
+      }
+    }
+
+    if (!sShardSummarySet)
+    {
+      auto summary = getenv("XM_SHARD_SUMMARY");
+      sShardSummary.assign(summary ? summary : "");
+    }
+
+    if (!sTimingCache.empty())
+    {
+      LoadTimingCache(sTimingCache.c_str(), mTimingCache);
+    }
+
+    ForEachAllowed([this](Test& test) { mTests.push_back(&test); }, [this]() { ++mIgnored; });
+
+    if (sShardCount > 1)
+    {
+      SelectShard();
+    }
+
+    if (sRerunMode != RerunMode::kAll)
+    {
+      // Move the tests that have failed last time to the front.
+      auto iEnd = std::stable_partition(mTests.begin(), mTests.end(), [this](Test* t) {
+        auto iFind = mTimingCache.find(HashId(t->mSuite, t->mName));
+        return iFind != mTimingCache.end() && iFind->second.failed;
+      });
+      mNumFailedBefore = size_t(iEnd - mTests.begin());
+    }
+
+    if (sShuffle)
+    {
+      mShuffleSeed = sShuffleSeed;
+      while (mShuffleSeed == 0)
+      {
+        mShuffleSeed = Rng(uint64_t(NowNs())).Next();
+      }
+
+      // Within each phase; see RunPhase().
+      Rng rng(mShuffleSeed);
+      Shuffle(mTests.begin(), mTests.begin() + mNumFailedBefore, rng);
+      Shuffle(mTests.begin() + mNumFailedBefore, mTests.end(), rng);
+    }
+
+    for (auto sf = sFirstSuiteFixture; sf; sf = sf->mNext)
+    {
+      sf->mNumRemaining = 0;
+    }
+
+    std::map<uint64_t, double> timeouts;
+    for (auto t = sFirstTimeout; t; t = t->mNext)
+    {
+      timeouts[HashId(t->mSuite, t->mName)] = t->mMilliseconds;
+    }
+
+    for (auto t : mTests)
+    {
+      auto iFind = timeouts.find(HashId(t->mSuite, t->mName));
+      if (iFind == timeouts.end())
+      {
+        if (auto slash = strchr(t->mName, '/')) // an instance of XM_TEST_P() etc.
+        {
+          iFind = timeouts.find(HashId(t->mSuite, std::string(t->mName, slash).c_str()));
+        }
+      }
+      t->mTimeout = iFind != timeouts.end() ? iFind->second : sDefaultTimeout;
+      mUseWatchdog |= t->mTimeout > .0;
+
+      if (t->mSuiteFixture)
+      {
+        ++t->mSuiteFixture->mNumRemaining;
+      }
+    }
+
+    if (sReporter)
+    {
+      mReporter.Add(*sReporter);
+    }
+    else
+    {
+      mConsoleReporter.reset(new ConsoleReporter);
+      mReporter.Add(*mConsoleReporter);
+    }
+
+    for (auto r : sExtraReporters)
+    {
+      mReporter.Add(*r);
+    }
+
+    for (int i = 0; i < int(std::size(sReportFiles)); ++i)
+    {
+      if (!sReportFiles[i].empty())
+      {
+        AddFileReporter(static_cast<ReportFormat>(i), sReportFiles[i]);
+      }
+    }
+  }
+
+  int Run()
+  {
+    auto numWorkers = std::min<size_t>(sConcurrency > 0 ? sConcurrency :
+      std::max(std::thread::hardware_concurrency(), 1u), mTests.size());
+    if (IsRepeating())
+    {
+      numWorkers = sConcurrencySet && sConcurrency > 0 ? sConcurrency :
+        std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    sNumRunWorkers = numWorkers;
+    CrashFlush crashFlush(mConsoleReporter.get());
+    auto strayFailures = sStrayFailures.load();
+    sTracing = !sTraceFile.empty();
+    sTraceStartNs = NowNs();
+    sRunPropertySeed = sPropertySeed;
+    while (sRunPropertySeed == 0)
+    {
+      sRunPropertySeed = Rng(uint64_t(NowNs())).Next();
+    }
+    mResults.reset(new Result[mTests.size()]);
+    if (!sBenchmarkBaseline.empty() && !LoadBaseline(sBenchmarkBaseline.c_str(), mBaseline))
+    {
+      Message("Failed to read benchmark baseline from ", sBenchmarkBaseline);
+    }
+
+#ifdef _WIN32
+    if (sIsolation)
+    {
+      mReporter.OnMessage("Process isolation is not supported on this platform; running in-process.");
+    }
+#else
+    struct sigaction ignorePipe {};
+    struct sigaction oldPipe;
+    if (sIsolation)
+    {
+      // A crashed child must not take the parent down when it's sent work.
+      ignorePipe.sa_handler = SIG_IGN;
+      sigaction(SIGPIPE, &ignorePipe, &oldPipe);
+    }
+#endif
+
+    // A misconfigured shard must not pass for running nothing.
+    if (sShardCount > 1 && sShardIndex >= sShardCount)
+    {
+      Message("Shard index out of range: ", std::to_string(sShardIndex));
+      ++mErrors;
+    }
+    else if (sShardCount > 1 && mTests.empty() && mOtherShards > 0)
+    {
+      Message("No tests in shard ", std::to_string(sShardIndex).append(1, '/').
+        append(std::to_string(sShardCount)));
+      ++mErrors;
+    }
+
+    if (sRerunMode != RerunMode::kAll && sTimingCache.empty())
+    {
+      mReporter.OnMessage("Re-running failed tests requires a timing cache; running all tests.");
+    }
+
+    if (mUseWatchdog)
+    {
+      mWatchdog.reset(new Watchdog(*this));
+    }
+
+    if (mShuffleSeed != 0)
+    {
+      Message("Shuffling with seed ", std::to_string(mShuffleSeed));
+    }
+
+    mReporter.OnRunStarted(mTests.size());
+
+    // Previously failed tests (if any) are run as a phase of their own, so that
+    // they're finished first even when running in parallel.
+    RunPhase(0, mNumFailedBefore, numWorkers);
+    if (!mStop && (sRerunMode != RerunMode::kFailedOnly || mPassed == mRun))
+    {
+      RunPhase(mNumFailedBefore, mTests.size(), numWorkers);
+    }
+
+    if (mRun < mTests.size())
+    {
+      Message("Stopped early; tests not run: ", std::to_string(mTests.size() - mRun));
+    }
+
+    mWatchdog.reset();
+
+    if (auto n = sStrayFailures - strayFailures)
+    {
+      Message("Failures on threads outside of any test, while others were running: ",
+        std::to_string(n));
+      ++mErrors;
+    }
+
+    // Suite fixtures whose tests haven't all run.
+    for (auto sf = sFirstSuiteFixture; sf; sf = sf->mNext)
+    {
+      sf->Destroy();
+      sf->mNumRemaining = 0;
+    }
+
+#ifndef _WIN32
+    if (sIsolation)
+    {
+      sigaction(SIGPIPE, &oldPipe, nullptr);
+    }
+#endif
+
+    if (mLastSuite)
+    {
+      mReporter.OnSuiteFinished(mLastSuite);
+    }
+
+    if (!sBenchmarkRecord.empty())
+    {
+      RecordBenchmarks();
+    }
+
+    if (!sShardSummary.empty())
+    {
+      WriteShardSummary();
+    }
+
+    if (!sTimingCache.empty())
+    {
+      UpdateTimingCache();
+    }
+
+    if (sTracing)
+    {
+      WriteTrace();
+      sTracing = false;
+    }
+
+    mReporter.OnRunFinished(Tally{ mRun, mPassed, mIgnored, mErrors });
+    return int(mRun - mPassed + mErrors);
+  }
+
+private:
+  std::vector<Test*> mTests;
+  size_t mNumFailedBefore = 0;
+  size_t mRun = 0;
+  size_t mPassed = 0;
+  std::atomic<bool> mStop{ false };
+  size_t mIgnored = 0;
+  size_t mOtherShards = 0;
+  size_t mErrors = 0;
+  TimingCache mTimingCache;
+  char const* mLastSuite = nullptr;
+  Baseline mBaseline;
+  std::unique_ptr<ConsoleReporter> mConsoleReporter;
+  std::vector<std::unique_ptr<std::ofstream>> mReportFiles;
+  std::vector<std::unique_ptr<Reporter>> mFileReporters;
+  MultiReporter mReporter;
+
+  bool mUseWatchdog = false;
+  std::unique_ptr<Watchdog> mWatchdog;
+  uint64_t mShuffleSeed = 0;
+
+  std::unique_ptr<Result[]> mResults;
+  std::vector<std::vector<size_t>> mGroups; // of indices into mTests, while running in parallel.
+  std::mutex mResultsMutex;
+  std::condition_variable mResultsCondition;
+
+  ///@brief Runs the test at @a index, in @a isolate if not null, otherwise on this thread.
+  void Execute(size_t index, Isolate* isolate)
+  {
+    Execute(index, isolate, mResults[index], index);
+  }
+
+  ///@brief Runs the test at @a index into @a result; @a watchId tells it apart from
+  /// the other tests in progress, for the watchdog.
+  void Execute(size_t index, Isolate* isolate, Result& result, size_t watchId)
+  {
+    auto beginNs = sTracing ? NowNs() : 0;
+    if (mWatchdog)
+    {
+      if (isolate)
+      {
+        isolate->Prefork(); // so that its child isn't replaced while being watched.
+      }
+      mWatchdog->Watch(watchId, index, isolate);
+    }
+
+    if (isolate)
+    {
+      isolate->Run(index, result);
+    }
+    else
+    {
+      RunTest(*mTests[index], result);
+    }
+
+    if (mWatchdog)
+    {
+      auto report = mWatchdog->Unwatch(watchId);
+      if (!report.empty())
+      {
+        result.passed = false;
+        result.error.swap(report);
+      }
+    }
+
+    if (sTracing)
+    {
+      auto& test = *mTests[index];
+      auto endNs = NowNs();
+      Trace(TraceEvent::kTest, test.mSuite, test.mName, beginNs, endNs);
+      if (!result.passed)
+      {
+        Trace(TraceEvent::kFailure, test.mSuite, test.mName, endNs, endNs);
+      }
+    }
+  }
+
+  void RunTest(Test& test, Result& result)
+  {
+    // The result may have been of another test, e.g. in an isolated child.
+    result.bench = BenchStats();
+    result.allocations = AllocationStats();
+    result.counters = PerfCounters{};
+
+    TestContext context;
+    sContext = &context;
+    sResult = &result;
+    sAssertionCount = 0;
+    sFailures.Reset();
+    sMessages.Reset();
+    PerfCounters counters;
+    if (sPerfCounters)
+    {
+      counters = ReadPerfCounters();
+    }
+    auto usage = SampleUsage();
+    Clock clock;
+    if (kTrackAllocations)
+    {
+      StartCountingAllocations();
+    }
+    {
+      RunningTest running(context);
+      result.passed = test.Run();
+    }
+    if (kTrackAllocations)
+    {
+      result.allocations = StopCountingAllocations();
+    }
+    if (sPerfCounters)
+    {
+      result.counters = PerfCounters{};
+      AddPerfCounters(counters, ReadPerfCounters(), result.counters);
+    }
+    if (test.mSuiteFixture && --test.mSuiteFixture->mNumRemaining == 0)
+    {
+      TraceSlice slice("suite teardown");
+      test.mSuiteFixture->Destroy();
+    }
+    result.duration = clock.Measure();
+    result.usage = GetUsageSince(usage);
+    result.assertions = sAssertionCount + context.GetAssertions();
+    sResult = nullptr;
+    sContext = nullptr;
+
+    // The failed expectations first, then the assertion (if any) that ended the test.
+    result.error.clear();
+    if (sFailures.Count() > 0)
+    {
+      result.passed = false;
+      sFailures.AppendTo(result.error);
+      sFailures.Reset();
+    }
+
+    if (context.HasFailures())
+    {
+      result.passed = false;
+      context.AppendTo(result.error);
+    }
+
+    if (sError)
+    {
+      if (!result.error.empty())
+      {
+        result.error.append(1, '\n');
+      }
+      result.error.append(sError);
+      sError = nullptr;
+    }
+
+    if (result.passed && result.bench.iterations > 0)
+    {
+      CompareToBaseline(test, result);
+    }
+  }
+
+  ///@brief Fails the benchmark @a test if its samples have regressed from the
+  /// baseline by more than the threshold. Having the median above the threshold
+  /// is not enough; the difference must also be statistically significant. The
+  /// kBaselineCounters per iteration, if counted in both, fail it by the threshold.
+  void CompareToBaseline(Test const& test, Result& result) const
+  {
+    auto id = MakeId(test);
+    char buffer[160];
+    auto iFind = mBaseline.find(id);
+    if (iFind != mBaseline.end() && !iFind->second.empty())
+    {
+      auto& baseline = iFind->second;
+      auto ratio = result.bench.median / Median(baseline);
+      auto p = MannWhitneyP(baseline, result.bench.samples);
+      if (ratio > 1. + sBenchmarkThreshold && p < kBenchmarkSignificance)
+      {
+        snprintf(buffer, sizeof(buffer), "Regressed from baseline by %.1f%% (median %.4gns "
+          "vs %.4gns, p = %.3g), past the threshold of %.1f%%.", (ratio - 1.) * 100.,
+          result.bench.median, Median(baseline), p, sBenchmarkThreshold * 100.);
+        AddRegression(buffer, result);
+      }
+    }
+
+    auto& counters = result.bench.counters;
+    for (auto& info : kPerfCounters)
+    {
+      if (!(info.bit & kBaselineCounters & counters.available))
+      {
+        continue;
+      }
+
+      iFind = mBaseline.find(MakeCounterKey(id, info));
+      if (iFind == mBaseline.end() || iFind->second[0] <= .0)
+      {
+        continue;
+      }
+
+      auto baseline = iFind->second[0];
+      auto perIteration = GetPerIteration(result.bench, info);
+      auto ratio = perIteration / baseline;
+      if (ratio > 1. + sBenchmarkThreshold)
+      {
+        snprintf(buffer, sizeof(buffer), "The %s per iteration regressed from baseline by "
+          "%.1f%% (%.4g vs %.4g), past the threshold of %.1f%%.", info.name,
+          (ratio - 1.) * 100., perIteration, baseline, sBenchmarkThreshold * 100.);
+        AddRegression(buffer, result);
+      }
+    }
+  }
+
+  static void AddRegression(char const* message, Result& result)
+  {
+    result.passed = false;
+    if (!result.error.empty())
+    {
+      result.error.append(1, '\n');
+    }
+    result.error.append(message);
+  }
+
+  static std::string MakeCounterKey(std::string id, PerfCounterInfo const& info)
+  {
+    return id.append(1, ':').append(info.key);
+  }
+
+  static double GetPerIteration(BenchStats const& bench, PerfCounterInfo const& info)
+  {
+    return double(bench.counters.*info.count) /
+      (double(bench.iterations) * double(bench.numSamples));
+  }
+
+  ///@brief Merges the samples of the benchmarks that have run, and their
+  /// kBaselineCounters per iteration, into the record file.
+  void RecordBenchmarks()
+  {
+    Baseline record;
+    LoadBaseline(sBenchmarkRecord.c_str(), record);
+    for (size_t i = 0; i < mRun; ++i)
+    {
+      auto& bench = mResults[i].bench;
+      if (bench.iterations > 0)
+      {
+        auto id = MakeId(*mTests[i]);
+        record[id] = bench.samples;
+        for (auto& info : kPerfCounters)
+        {
+          if (info.bit & kBaselineCounters & bench.counters.available)
+          {
+            record[MakeCounterKey(id, info)] = { GetPerIteration(bench, info) };
+          }
+          else if (info.bit & kBaselineCounters)
+          {
+            record.erase(MakeCounterKey(id, info));  // stale, with the samples replaced.
+          }
+        }
+      }
+    }
+
+    if (!SaveBaseline(sBenchmarkRecord.c_str(), record))
+    {
+      Message("Failed to write benchmark record to ", sBenchmarkRecord);
+    }
+  }
+
+  ///@brief Removes the tests from mTests that belong to other shards. With timings
+  /// of earlier runs, shards are balanced by their expected duration, otherwise tests
+  /// are assigned by the hash of their id.
+  ///@note The assignment by duration is only consistent across shards, if they all
+  /// use the same timing cache.
+  void SelectShard()
+  {
+    std::vector<Test*> tests;
+    if (mTimingCache.empty())
+    {
+      for (auto t : mTests)
+      {
+        if (HashId(t->mSuite, t->mName) % sShardCount == sShardIndex)
+        {
+          tests.push_back(t);
+        }
+      }
+    }
+    else if (sShardIndex < sShardCount)
+    {
+      auto shards = AssignLongestFirst(GetExpectedDurations(), sShardCount);
+      auto& shard = shards[sShardIndex];
+      std::sort(shard.begin(), shard.end());
+      for (auto i : shard)
+      {
+        tests.push_back(mTests[i]);
+      }
+    }
+
+    mOtherShards = mTests.size() - tests.size();
+    mTests.swap(tests);
+  }
+
+  ///@return The durations of mTests from the timing cache. Tests that are missing
+  /// from it are expected to take the mean duration of the others.
+  std::vector<double> GetExpectedDurations() const
+  {
+    std::vector<double> durations(mTests.size(), -1.);
+    double sum = .0;
+    size_t numKnown = 0;
+    for (size_t i = 0; i < mTests.size(); ++i)
+    {
+      auto iFind = mTimingCache.find(HashId(mTests[i]->mSuite, mTests[i]->mName));
+      if (iFind != mTimingCache.end())
+      {
+        durations[i] = iFind->second.duration;
+        sum += iFind->second.duration;
+        ++numKnown;
+      }
+    }
+
+    auto mean = numKnown > 0 ? sum / numKnown : 1.;
+    for (auto& d : durations)
+    {
+      d = d < .0 ? mean : d;
+    }
+    return durations;
+  }
+
+  ///@brief Blends the durations of this run into the timing cache, and saves it.
+  void UpdateTimingCache()
+  {
+    for (size_t i = 0; i < mRun; ++i)
+    {
+      auto& result = mResults[i];
+      auto duration = float(result.duration);
+      auto hash = HashId(mTests[i]->mSuite, mTests[i]->mName);
+      auto iInsert = mTimingCache.insert({ hash, TestHistory{ duration, !result.passed } });
+      if (!iInsert.second)
+      {
+        auto& cached = iInsert.first->second;
+        cached.duration += (duration - cached.duration) * kTimingCacheLatestWeight;
+        cached.failed = !result.passed;
+      }
+    }
+
+    if (!SaveTimingCache(sTimingCache.c_str(), mTimingCache))
+    {
+      Message("Failed to write timing cache to ", sTimingCache);
+    }
+  }
+
+  void WriteShardSummary()
+  {
+    std::ofstream file(sShardSummary);
+    file << "{\"shard\":" << sShardIndex << ",\"count\":" << std::max(sShardCount, 1u) <<
+      ",\"run\":" << mRun << ",\"passed\":" << mPassed << ",\"ignored\":" <<
+      mIgnored << ",\"other_shards\":" << mOtherShards << ",\"failed\":[";
+    bool first = true;
+    for (size_t i = 0; i < mRun; ++i)
+    {
+      if (!mResults[i].passed)
+      {
+        file << (first ? "" : ",");
+        WriteJsonString(file, MakeId(*mTests[i]).c_str());
+        first = false;
+      }
+    }
+    file << "]}\n";
+
+    if (!file.flush())
+    {
+      Message("Failed to write shard summary to ", sShardSummary);
+    }
+  }
+
+  ///@brief Writes the events of all threads to the trace file, then discards them,
+  /// along with the buffers of the threads that have exited.
+  void WriteTrace()
+  {
+    std::ofstream file(sTraceFile);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    char const* separator = "\n";
+    char buffer[96];
+    auto toUs = [](int64_t ns) { return double(ns - sTraceStartNs) * 1e-3; };
+
+    std::lock_guard<std::mutex> lock(sTraceMutex);
+    for (auto& thread : sTraceBuffers)
+    {
+      file << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" <<
+        thread->thread << ",\"args\":{\"name\":\"xm thread " << thread->thread << "\"}}";
+      separator = ",\n";
+
+      auto i = thread->count > TraceBuffer::kSize ? thread->count - TraceBuffer::kSize : 0;
+      for (; i < thread->count; ++i)
+      {
+        auto& event = thread->events[i % TraceBuffer::kSize];
+        file << separator << "{\"name\":";
+        if (event.kind == TraceEvent::kSlice)
+        {
+          WriteJsonString(file, event.name);
+        }
+        else
+        {
+          WriteJsonString(file, std::string(event.suite).append(1, kJoinTestSuiteName).
+            append(event.name).c_str());
+        }
+
+        if (event.kind == TraceEvent::kFailure)
+        {
+          snprintf(buffer, sizeof(buffer), "\"failure\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f",
+            toUs(event.endNs));
+        }
+        else
+        {
+          snprintf(buffer, sizeof(buffer), "\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f",
+            event.kind == TraceEvent::kTest ? "test" : "fixture", toUs(event.beginNs),
+            double(event.endNs - event.beginNs) * 1e-3);
+        }
+        file << ",\"cat\":" << buffer << ",\"pid\":1,\"tid\":" << thread->thread << "}";
+      }
+      thread->count = 0;
+    }
+    file << "\n]}\n";
+
+    sTraceBuffers.erase(std::remove_if(sTraceBuffers.begin(), sTraceBuffers.end(),
+      [](std::unique_ptr<TraceBuffer> const& thread) { return thread->retired; }),
+      sTraceBuffers.end());
+
+    if (!file.flush())
+    {
+      Message("Failed to write trace to ", sTraceFile);
+    }
+  }
+
+  void Message(char const* message, std::string const& path)
+  {
+    auto text = std::string(message).append(path).append(1, '.');
+    mReporter.OnMessage(text.c_str());
+  }
+
+  void AddFileReporter(ReportFormat format, std::string const& path)
+  {
+    std::unique_ptr<std::ofstream> file(new std::ofstream(path));
+    if (!*file)
+    {
+      Message("Failed to open report file ", path);
+      return;
+    }
+
+    std::unique_ptr<Reporter> reporter;
+    switch (format)
+    {
+    case ReportFormat::kJUnitXml:
+      reporter.reset(new JUnitReporter(*file));
+      break;
+    case ReportFormat::kJsonLines:
+      reporter.reset(new JsonLinesReporter(*file));
+      break;
+    case ReportFormat::kTap:
+      reporter.reset(new TapReporter(*file));
+      break;
+    }
+
+    mReporter.Add(*reporter);
+    mReportFiles.push_back(std::move(file));
+    mFileReporters.push_back(std::move(reporter));
+  }
+
+  static std::string MakeId(Test const& test)
+  {
+    return std::string(test.mSuite).append(1, kJoinTestSuiteName).append(test.mName);
+  }
+
+  ///@brief Runs and reports the tests in the [ @a begin, @a end ) range of mTests,
+  /// using up to @a numWorkers threads, unless it's time to stop.
+  void RunPhase(size_t begin, size_t end, size_t numWorkers)
+  {
+    if (IsRepeating())
+    {
+      RunRepeated(begin, end, numWorkers);
+      return;
+    }
+
+    numWorkers = std::min(numWorkers, end - begin);
+    if (numWorkers > 1)
+    {
+      RunParallel(begin, end, numWorkers);
+    }
+    else if (begin < end)
+    {
+      std::unique_ptr<Isolate> isolate(sIsolation ? new Isolate(*this) : nullptr);
+      for (size_t i = begin; i < end && !mStop; ++i)
+      {
+        ReportStarted(*mTests[i]);
+        Execute(i, isolate.get());
+        ReportFinished(*mTests[i], mResults[i]);
+      }
+    }
+  }
+
+  void RunParallel(size_t begin, size_t end, size_t numWorkers)
+  {
+    // Work is handed out in groups of tests, which are run one after the other by
+    // the same worker: the tests of a suite fixture make up a group, and every other
+    // test is a group of its own. Benchmarks are left to run on this thread, once
+    // the workers have finished.
+    std::vector<std::vector<size_t>> groups;
+    std::map<SuiteFixtureBase*, size_t> suiteFixtureGroups;
+    for (size_t i = begin; i < end; ++i)
+    {
+      auto test = mTests[i];
+      if (test->mIsBenchmark)
+      {
+        continue;
+      }
+
+      if (test->mSuiteFixture)
+      {
+        auto iInsert = suiteFixtureGroups.insert({ test->mSuiteFixture, groups.size() });
+        if (iInsert.second)
+        {
+          groups.emplace_back();
+        }
+        groups[iInsert.first->second].push_back(i);
+      }
+      else
+      {
+        groups.push_back({ i });
+      }
+    }
+    mGroups.swap(groups);
+
+    // With timings of earlier runs, hand out the longest groups first, balancing the
+    // expected load of workers. Otherwise hand out contiguous ranges, so that suites
+    // tend to stay on the same worker.
+    std::unique_ptr<Queue[]> queues(new Queue[numWorkers]);
+    auto numGroups = mGroups.size();
+    if (!mTimingCache.empty())
+    {
+      auto durations = GetExpectedDurations();
+      std::vector<double> costs(numGroups, .0);
+      for (size_t i = 0; i < numGroups; ++i)
+      {
+        for (auto j : mGroups[i])
+        {
+          costs[i] += durations[j];
+        }
+      }
+
+      auto bins = AssignLongestFirst(costs, numWorkers);
+      for (size_t i = 0; i < numWorkers; ++i)
+      {
+        queues[i].indices.assign(bins[i].begin(), bins[i].end());
+      }
+    }
+    else
+    {
+      for (size_t i = 0; i < numWorkers; ++i)
+      {
+        auto iEnd = (i + 1) * numGroups / numWorkers;
+        for (size_t j = i * numGroups / numWorkers; j < iEnd; ++j)
+        {
+          queues[i].indices.push_back(j);
+        }
+      }
+    }
+
+    // Isolated processes are started up front, while this is the only thread.
+    std::vector<std::unique_ptr<Isolate>> isolates(numWorkers);
+    if (sIsolation)
+    {
+      for (auto& isolate : isolates)
+      {
+        isolate.reset(new Isolate(*this));
+        isolate->Prefork();
+      }
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(numWorkers);
+    for (size_t i = 0; i < numWorkers; ++i)
+    {
+      workers.emplace_back([this, &queues, &isolates, numWorkers, i] {
+        size_t group;
+        while (!mStop && TakeWork(queues.get(), numWorkers, i, group))
+        {
+          for (auto index : mGroups[group])
+          {
+            if (!mStop)
+            {
+              Execute(index, isolates[i].get());
+            }
+
+            std::lock_guard<std::mutex> lock(mResultsMutex);
+            mResults[index].done = true;
+            mResultsCondition.notify_all();
+          }
+        }
+      });
+    }
+
+    auto joinWorkers = [&workers] {
+      for (auto& w : workers)
+      {
+        w.join();
+      }
+      workers.clear();
+    };
+
+    // Report results in order, as they become available.
+    for (size_t i = begin; i < end && !mStop; ++i)
+    {
+      auto& test = *mTests[i];
+      auto& result = mResults[i];
+      if (test.mIsBenchmark)
+      {
+        joinWorkers();
+        ReportStarted(test);
+        Execute(i, isolates[0].get());
+      }
+      else
+      {
+        std::unique_lock<std::mutex> lock(mResultsMutex);
+        mResultsCondition.wait(lock, [&result] { return result.done; });
+        lock.unlock();
+
+        ReportStarted(test);
+      }
+
+      ReportFinished(test, result);
+    }
+
+    joinWorkers();
+  }
+
+  static bool IsRepeating()
+  {
+    return sRepeatCount > 1 || sUntilFail;
+  }
+
+  ///@brief Runs the tests in [ @a begin, @a end ) one at a time, and the repeats of
+  /// each on @a numWorkers threads; see SetRepeat().
+  void RunRepeated(size_t begin, size_t end, size_t numWorkers)
+  {
+    // Isolated processes are started up front, while this is the only thread.
+    std::vector<std::unique_ptr<Isolate>> isolates(numWorkers);
+    if (sIsolation)
+    {
+      for (auto& isolate : isolates)
+      {
+        isolate.reset(new Isolate(*this));
+        isolate->Prefork();
+      }
+    }
+
+    auto limit = sRepeatCount > 0 ? size_t(sRepeatCount) : SIZE_MAX;
+    for (size_t i = begin; i < end && !mStop; ++i)
+    {
+      auto& test = *mTests[i];
+      ReportStarted(test);
+      if (test.mIsBenchmark)
+      {
+        Execute(i, isolates[0].get());
+        ReportFinished(test, mResults[i]);
+        continue;
+      }
+
+      auto summary = Repeat(i, test.mSuiteFixture ? 1 : std::min(numWorkers, limit), limit,
+        isolates);
+      ReportFinished(test, mResults[i]);
+      mReporter.OnMessage(MakeId(test).append(summary).c_str());
+    }
+  }
+
+  ///@brief Runs the test at @a index up to @a limit times, on @a numWorkers threads,
+  /// folding the results into its own: it passes if all repeats did, with the median
+  /// of their durations; otherwise it has the error of the first repeat that failed.
+  ///@return A summary of the repeats.
+  std::string Repeat(size_t index, size_t numWorkers, size_t limit,
+    std::vector<std::unique_ptr<Isolate>> const& isolates)
+  {
+    auto& test = *mTests[index];
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> firstFailed{ SIZE_MAX };
+    std::atomic<size_t> numAssertions{ 0 };
+    size_t numFailed = 0;
+    Result folded;  // of the first repeat that failed, or the first one.
+    size_t foldedRepeat = SIZE_MAX;
+    std::vector<std::vector<double>> durations(numWorkers);
+    std::mutex mutex;
+    auto repeat = [&](size_t worker) {
+      Result result;
+      size_t n;
+      while (!mStop && (n = next++) < limit && !(sUntilFail && n > firstFailed))
+      {
+        if (test.mSuiteFixture)
+        {
+          ++test.mSuiteFixture->mNumRemaining; // not the last of its tests to run, yet.
+        }
+
+        Execute(index, isolates[worker].get(), result, mTests.size() + worker);
+        durations[worker].push_back(result.duration);
+        numAssertions += result.assertions;
+        if (!result.passed || n == 0)
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          numFailed += !result.passed;
+          if (!result.passed && n < firstFailed)
+          {
+            firstFailed = n;
+          }
+
+          if (n == firstFailed || foldedRepeat == SIZE_MAX)
+          {
+            folded = std::move(result);
+            foldedRepeat = n;
+          }
+        }
+      }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(numWorkers - 1);
+    for (size_t i = 1; i < numWorkers; ++i)
+    {
+      workers.emplace_back(repeat, i);
+    }
+    repeat(0);
+    for (auto& w : workers)
+    {
+      w.join();
+    }
+
+    if (test.mSuiteFixture && --test.mSuiteFixture->mNumRemaining == 0)
+    {
+      test.mSuiteFixture->Destroy();
+    }
+
+    std::vector<double> all;
+    for (auto& d : durations)
+    {
+      all.insert(all.end(), d.begin(), d.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    auto& result = mResults[index];
+    result = std::move(folded);
+    result.passed = numFailed == 0;
+    result.assertions = numAssertions;
+    result.duration = all.empty() ? .0 : all[all.size() / 2];
+
+    char buffer[192];
+    if (numFailed > 0)
+    {
+      snprintf(buffer, sizeof(buffer), "Failed %zu of %zu repeats, first at repeat %zu:\n",
+        numFailed, all.size(), size_t(firstFailed) + 1);
+      result.error.insert(0, buffer);
+    }
+
+    if (all.empty())
+    {
+      return ": not repeated.";
+    }
+    snprintf(buffer, sizeof(buffer), ": %zu repeats, %zu failed; min %.6gms, median %.6gms,"
+      " 90th percentile %.6gms, max %.6gms.", all.size(), numFailed, all.front(),
+      all[all.size() / 2], all[(all.size() - 1) * 9 / 10], all.back());
+    return buffer;
+  }
+
+  ///@brief Takes the next index from the queue of worker @a i or, if that is
+  /// exhausted, steals one from the back of the others'.
+  ///@return false if there was no work left, true otherwise.
+  static bool TakeWork(Queue* queues, size_t numWorkers, size_t i, size_t& index)
+  {
+    {
+      auto& own = queues[i];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.indices.empty())
+      {
+        index = own.indices.front();
+        own.indices.pop_front();
+        return true;
+      }
+    }
+
+    for (size_t j = 1; j < numWorkers; ++j)
+    {
+      auto& victim = queues[(i + j) % numWorkers];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.indices.empty())
+      {
+        index = victim.indices.back();
+        victim.indices.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  ///@brief Writes out the output of the reporters so far, as the process is about to
+  /// be aborted from another thread than the one reporting, which is locked out.
+  void FlushReports()
+  {
+    if (!mReporter.Lock(sc::seconds(1)))
+    {
+      return;
+    }
+
+    if (mConsoleReporter)
+    {
+      mConsoleReporter->Flush();
+    }
+
+    for (auto& file : mReportFiles)
+    {
+      file->flush();
+    }
+  }
+
+  void ReportStarted(Test const& test)
+  {
+    if (test.mSuite != mLastSuite)
+    {
+      if (mLastSuite)
+      {
+        mReporter.OnSuiteFinished(mLastSuite);
+      }
+
+      mReporter.OnSuiteStarted(test.mSuite);
+      mLastSuite = test.mSuite;
+    }
+
+    mReporter.OnTestStarted(test.mSuite, test.mName);
+  }
+
+  void ReportFinished(Test const& test, Result const& result)
+  {
+    ++mRun;
+    mPassed += result.passed;
+    if (!result.passed && sFailFast)
+    {
+      mStop = true;
+    }
+
+    mReporter.OnTestFinished(TestResult{ test.mSuite, test.mName, result.passed,
+      result.duration, result.error.empty() ? nullptr : result.error.c_str(),
+      result.bench.iterations > 0 ? &result.bench : nullptr, result.assertions,
+      kTrackAllocations ? &result.allocations : nullptr,
+      sPerfCounters && result.counters.available ? &result.counters : nullptr,
+      &result.usage });
+
+    if (result.passed && test.mTimeout > .0 && result.duration > test.mTimeout * kTimeoutWarningRatio)
+    {
+      char buffer[96];
+      snprintf(buffer, sizeof(buffer), " took %.6gms; close to its timeout of %.6gms.",
+        result.duration, test.mTimeout);
+      mReporter.OnMessage(MakeId(test).append(buffer).c_str());
+    }
+  }
+};
+
+} // detail
+
+int RunTests()
+{
+  return sListOnly ? detail::Runner::List() : detail::Runner().Run();
+}
+
+ThreadGuard::ThreadGuard()
+: mContext(sContext)
+{}
+
+namespace detail
+{
+
+// Provides a facility to format strings into thread local storage, which is
+// pre-allocated, and only grows when a message doesn't fit (up to the limit set by
+// SetMessageLimit()). The string remains valid until the next test starts.
+struct StaticStringBuilder
+{
+  StaticStringBuilder();
+  ~StaticStringBuilder();
+
+  std::ostream& Stream() { return mStream; }
+
+  ///@brief Terminates the string, after which the stream must not be written to.
+  operator char const*();
+
+private:
+  AllocationPause mPause; // of the formatting of values, which may allocate.
+  std::ostream mStream;
+  char const* mMessage = nullptr;
+
+  StaticStringBuilder(StaticStringBuilder const&) = delete;
+  StaticStringBuilder& operator=(StaticStringBuilder const&) = delete;
+  StaticStringBuilder(StaticStringBuilder&&) = delete;
+  StaticStringBuilder& operator=(StaticStringBuilder&&) = delete;
+};
+
+std::ostream& operator<<(std::ostream& os, StringWrap const& sw)
+{
+  auto i0 = sw.mString;
+  auto i1 = i0 + sw.mSize;
+  while (i0 != i1)
+  {
+    os.put(*i0);
+    ++i0;
+  }
+  return os;
+}
+
+StaticStringBuilder::StaticStringBuilder()
+: mStream(&sMessages)
+{
+  sMessages.Begin();
+}
+
+StaticStringBuilder::~StaticStringBuilder()
+{
+  if (!mMessage)
+  {
+    sMessages.End();
+  }
+}
+
+StaticStringBuilder::operator char const*()
+{
+  if (!mMessage)
+  {
+    mMessage = sMessages.End();
+  }
+  return mMessage;
+}
+
+// Prints @a size bytes in hex, in lines of up to 64, and up to the limit set by
+// SetMaxBytesPrinted(), after which an ellipsis is printed.
+void PrintBytes(uint8_t const* bytes, size_t size, std::ostream& os);
+
+void Print(Printable const& value, std::ostream& os)
+{
+  switch (value.kind)
+  {
+  case Printable::kInteger:
+    os << value.integer;
+    break;
+  case Printable::kFloat:
+    os << value.f << "f";
+    break;
+  case Printable::kDouble:
+    os << value.d;
+    break;
+  case Printable::kBool:
+    os << (value.b ? "true" : "false");
+    break;
+  case Printable::kString:
+    os << "\"";
+    os.write(static_cast<char const*>(value.bytes.data), std::streamsize(value.bytes.size));
+    os << "\"";
+    break;
+  case Printable::kPointer:
+    os << value.pointer;
+    break;
+  case Printable::kNullptr:
+    os << "nullptr";
+    break;
+  case Printable::kBytes:
+    PrintBytes(static_cast<uint8_t const*>(value.bytes.data), value.bytes.size, os);
+    break;
+  case Printable::kCustom:
+    value.custom.print(value.custom.value, os);
+    break;
+  }
+}
+
+void AppendPrintable(Printable const& value, std::string& out)
+{
+  AllocationPause pause;
+  StringBuf buffer;
+  buffer.mString.swap(out);
+  {
+    std::ostream stream(&buffer);
+    Print(value, stream);
+  }
+  out.swap(buffer.mString);
+}
+
+// Prints @a expr, followed by @a value, unless that reads the same.
+void FormatExpression(char const* expr, Printable const& value, std::ostream& os)
+{
+  os << expr;
+
+  std::string printed;
+  AppendPrintable(value, printed);
+  if (printed.compare(expr) != 0)
+  {
+    os << " (which is " << printed << ")";
+  }
+}
+
+// Prints the elements of @a range around @a index, from @a first, marking the one at
+// @a index.
+void FormatRangeWindow(char const* str, PrintableRange const& range, size_t first,
+  size_t index, std::ostream& os)
+{
+  constexpr size_t kRangeDiffContext = 3; // the number of elements on either side
+  os << "\n  " << str << "[" << first << "..]:";
+  auto last = std::min(index + kRangeDiffContext + 1, range.size);
+  for (auto j = first; j < last; ++j)
+  {
+    os << (j == index ? " >" : " ");
+    range.printAt(range.range, j, os);
+    if (j == index)
+    {
+      os << "<";
+    }
+  }
+
+  if (last < range.size)
+  {
+    os << " ...";
+  }
+}
+
+char const* Formatter::FormatComparison(char const* aStr, Printable const& a,
+  char const* opStr, char const* bStr, Printable const& b)
+{
+  StaticStringBuilder ssb;
+  auto& stream = ssb.Stream();
+  stream << "Expected: ";
+  FormatExpression(aStr, a, stream);
+  stream << " " << opStr << " ";
+  FormatExpression(bStr, b, stream);
+
+  return ssb;
+}
+
+char const* Formatter::FormatRangeMismatch(char const* aStr, PrintableRange const& a,
+  char const* bStr, PrintableRange const& b, size_t index)
+{
+  constexpr size_t kRangeDiffContext = 3;
+  StaticStringBuilder ssb;
+  auto& stream = ssb.Stream();
+  stream << "Expected: " << aStr << " == " << bStr << ", element-wise (sizes: " <<
+    a.size << ", " << b.size << "); first mismatch at [" << index << "]:";
+
+  auto first = index > kRangeDiffContext ? index - kRangeDiffContext : 0;
+  FormatRangeWindow(aStr, a, first, index, stream);
+  FormatRangeWindow(bStr, b, first, index, stream);
+
+  return ssb;
+}
+
+char const* Formatter::Format(char const* str)
+{
+  StaticStringBuilder ssb;
+  auto& stream = ssb.Stream();
+  stream << "Expected: " << str;
+
+  return ssb;
+}
+
+void PrintBytes(uint8_t const* bytes, size_t size, std::ostream& os)
+{
+  constexpr size_t kLineSize = 64;
+  char line[kLineSize * 3];
+  auto printed = std::min(size, sMaxBytesPrinted);
+  for (size_t i = 0; i < printed; i += kLineSize)
+  {
+    auto lineSize = std::min(kLineSize, printed - i);
+    auto end = EncodeHex(bytes + i, lineSize, line);
+    if (i + lineSize < printed)
+    {
+      end[-1] = '\n';
+    }
+    os.write(line, end - line);
+  }
+
+  if (size > printed)
+  {
+    os << "...";
+  }
+}
+
+char const* Formatter::FormatMemMismatch(char const* aStr, uint8_t const* a, char const* bStr,
+  uint8_t const* b, size_t size, size_t offset)
+{
+  constexpr size_t kRowSize = 16;
+  StaticStringBuilder ssb;
+  auto& stream = ssb.Stream();
+  char buffer[128];
+  snprintf(buffer, sizeof(buffer), " (%zu bytes); first mismatch at offset %zu (0x%zx):",
+    size, offset, offset);
+  stream << "Expected: memory at " << aStr << " == " << bStr << buffer;
+
+  // The row of the mismatch, with one before and after it; the differing bytes are
+  // marked underneath.
+  auto aLength = strlen(aStr);
+  auto bLength = strlen(bStr);
+  auto labelWidth = std::max(aLength, bLength);
+  auto row = offset / kRowSize * kRowSize;
+  auto first = row > kRowSize ? row - kRowSize : 0;
+  auto last = std::min(row + 2 * kRowSize, size);
+  for (auto i = first; i < last; i += kRowSize)
+  {
+    auto rowSize = std::min(kRowSize, last - i);
+    auto printRow = [&](char const* label, size_t length, uint8_t const* bytes) {
+      stream << "\n  " << label << std::string(labelWidth - length, ' ');
+      auto p = buffer + snprintf(buffer, sizeof(buffer), " +0x%zx: ", i);
+      p = EncodeHex(bytes + i, rowSize, p);
+      stream.write(buffer, p - buffer - 1);  // sans the last space
+    };
+    printRow(aStr, aLength, a);
+    printRow(bStr, bLength, b);
+
+    if (memcmp(a + i, b + i, rowSize) != 0)
+    {
+      auto width = snprintf(buffer, sizeof(buffer), " +0x%zx:", i);
+      stream << "\n  " << std::string(labelWidth + width, ' ');
+      for (size_t j = 0; j < rowSize; ++j)
+      {
+        stream << (a[i + j] != b[i + j] ? " ^^" : "   ");
+      }
+    }
+  }
+
+  return ssb;
+}
+
+size_t FindMismatch(void const* a, void const* b, size_t size)
+{
+  // memcmp() whole blocks, and only check the bytes of the first one that differs.
+  constexpr size_t kBlockSize = 4096;
+  auto pA = static_cast<uint8_t const*>(a);
+  auto pB = static_cast<uint8_t const*>(b);
+  size_t offset = 0;
+  while (offset < size)
+  {
+    auto blockSize = std::min(kBlockSize, size - offset);
+    if (memcmp(pA + offset, pB + offset, blockSize) != 0)
+    {
+      while (pA[offset] == pB[offset])
+      {
+        ++offset;
+      }
+      return offset;
+    }
+    offset += blockSize;
+  }
+  return size;
+}
+
+void Fail(char const* message)
+{
+#if defined XM_NO_EXCEPTIONS
+  RecordFailure(message);
+#else
+  if (sCatchDepth == 0)
+  {
+    fprintf(stderr, "Assertion failed outside of a test (see xm::ThreadGuard): %s\n",
+      message);
+    fflush(stderr);
+    std::abort();
+  }
+  throw Exception{ message };
+#endif
+}
+
+void RecordFailure(char const* message)
+{
+  if (sInGuard)
+  {
+    sContext->Add(message);
+  }
+  else if (sCatchDepth == 0)
+  {
+    std::lock_guard<std::mutex> lock(sSoleContextMutex);
+    if (sSoleContext)
+    {
+      sSoleContext->Add(message);
+    }
+    else
+    {
+      ++sStrayFailures;
+      fprintf(stderr, "Failure outside of a test (see xm::ThreadGuard): %s\n", message);
+      fflush(stderr);
+    }
+  }
+  else
+  {
+    sFailures.Add(message);
+  }
+}
+
+void RunInContext(TestContext* testContext, void (*fn)(void const* context),
+  void const* context)
+{
+  if (!testContext)
+  {
+    fn(context);
+    return;
+  }
+
+  auto outerContext = sContext;
+  auto outerInGuard = sInGuard;
+  auto outerAssertions = sAssertionCount;
+  sContext = testContext;
+  sInGuard = true;
+  {
+    CatchScope catching;
+#if defined XM_HAS_EXCEPTIONS
+    try
+    {
+      fn(context);
+    }
+#if !defined XM_NO_EXCEPTIONS
+    catch (Exception const& e)
+    {
+      testContext->Add(e.message);
+    }
+#endif
+    catch (...)
+    {
+      testContext->Add("Bad exception thrown.");
+    }
+#else
+    fn(context);
+#endif
+  }
+
+  testContext->AddAssertions(sAssertionCount - outerAssertions);
+  sAssertionCount = outerAssertions;
+  sContext = outerContext;
+  sInGuard = outerInGuard;
+  if (!sResult && !outerInGuard)
+  {
+    sMessages.Reset();  // of the failures, which have been copied.
+  }
+}
+
+bool CheckCase(void (*fn)(void const* context), void const* context, std::string& error)
+{
+  CatchScope catching;
+#if defined XM_HAS_EXCEPTIONS
+  try
+  {
+    fn(context);
+  }
+#if !defined XM_NO_EXCEPTIONS
+  catch (Exception const& e)
+  {
+    AllocationPause pause;
+    error = e.message;
+  }
+#endif
+  catch (...)
+  {
+    AllocationPause pause;
+    error = "Bad exception thrown.";
+  }
+#else
+  fn(context);
+#endif
+
+  bool passed = error.empty() && sFailures.Count() == 0;
+  if (sFailures.Count() > 0)
+  {
+    AllocationPause pause;
+    std::string expectations;
+    sFailures.AppendTo(expectations);
+    if (!error.empty())
+    {
+      expectations.append(1, '\n').append(error);
+    }
+    error.swap(expectations);
+  }
+  sFailures.Reset();
+  sMessages.Reset();
+  return passed;
+}
+
+void CheckProperty(char const* suite, char const* name, CheckFn check, void const* context,
+  PropertyCheck& result)
+{
+  result.runSeed = sRunPropertySeed;
+  result.numCases = sPropertyCases;
+  result.failedCase = result.numCases;
+  auto baseSeed = sRunPropertySeed ^ HashId(suite, name);
+  auto getSeed = [baseSeed](size_t i) {
+    return Rng(baseSeed + i).Next();
+  };
+
+  auto numThreads = std::min<size_t>(sPropertyThreads > 0 ? sPropertyThreads :
+    sNumRunWorkers > 1 ? 1 : std::max(std::thread::hardware_concurrency(), 1u),
+    result.numCases);
+  if (numThreads <= 1)
+  {
+    for (size_t i = 0; i < result.numCases; ++i)
+    {
+      auto seed = getSeed(i);
+      if (!check(context, seed, result.error))
+      {
+        result.failedCase = i;
+        result.failedSeed = seed;
+        break;
+      }
+    }
+    return;
+  }
+
+  // Threads take the next case in order, and stop once they're past the first one that
+  // has failed; by then, those before it have all been checked. The threads spawned
+  // add their assertions to those of the test.
+  std::atomic<size_t> next{ 0 };
+  std::atomic<size_t> failedCase{ result.numCases };
+  std::atomic<size_t> numAssertions{ 0 };
+  std::mutex mutex;
+  auto checkCases = [&]() {
+    std::string error;
+    size_t i;
+    while ((i = next++) < failedCase)
+    {
+      auto seed = getSeed(i);
+      error.clear();
+      if (!check(context, seed, error))
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (i < result.failedCase)
+        {
+          result.failedCase = i;
+          result.failedSeed = seed;
+          result.error.swap(error);
+          failedCase = i;
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  {
+    AllocationPause pause;
+    threads.reserve(numThreads - 1);
+    for (size_t i = 1; i < numThreads; ++i)
+    {
+      threads.emplace_back([&checkCases, &numAssertions, testContext = sContext]() {
+        sContext = testContext; // for the threads that a case may spawn.
+        checkCases();
+        numAssertions += sAssertionCount;
+      });
+    }
+  }
+
+  checkCases();
+  for (auto& t : threads)
+  {
+    t.join();
+  }
+  sAssertionCount += numAssertions;
+}
+
+void FailProperty(PropertyCheck const& result, char const* arguments, size_t numShrinks)
+{
+  StaticStringBuilder ssb;
+  ssb.Stream() << "Property failed at case " << result.failedCase + 1 << " of " <<
+    result.numCases << " (seed: " << result.runSeed << "), shrunk in " << numShrinks <<
+    " steps to: " << arguments << "\n" << result.error;
+  Fail(ssb);
+}
+
+bool Assert::True(bool value, char const* str, FailFn fail)
+{
+  ++sAssertionCount;
+  if (!value)
+  {
+    fail(Formatter::Format(str));
+  }
+  return value;
+}
+
+bool Assert::MemEqual(void const* a, void const* b, size_t size, char const* aStr,
+  char const* bStr, FailFn fail)
+{
+  ++sAssertionCount;
+  auto offset = FindMismatch(a, b, size);
+  if (offset < size)
+  {
+    fail(Formatter::FormatMemMismatch(aStr, static_cast<uint8_t const*>(a), bStr,
+      static_cast<uint8_t const*>(b), size, offset));
+    return false;
+  }
+  return true;
+}
+
+bool Assert::Check(bool value, char const* message)
+{
+  if (!value)
+  {
+    Fail(message);
+  }
+  return value;
+}
+
+bool Assert::MaxAllocations(size_t max, char const* maxStr)
+{
+  ++sAssertionCount;
+  if (!kTrackAllocations)
+  {
+    Fail("Allocations are not tracked; define XM_TRACK_ALLOCATIONS when compiling xm.cpp.");
+    return false;
+  }
+
+  auto count = sAllocations.count;
+  if (count > max)
+  {
+    Fail(Formatter::Format("allocations", count, "<=", maxStr, max));
+    return false;
+  }
+  return true;
+}
+
+NoAllocationsScope::NoAllocationsScope()
+: mStartCount(sAllocations.count)
+{}
+
+bool NoAllocationsScope::Next()
+{
+  if (!mEntered)
+  {
+    mEntered = true;
+    return true;
+  }
+
+  ++sAssertionCount;
+  if (!kTrackAllocations)
+  {
+    Fail("Allocations are not tracked; define XM_TRACK_ALLOCATIONS when compiling xm.cpp.");
+    return false;
+  }
+
+  auto count = sAllocations.count - mStartCount;
+  if (count > 0)
+  {
+    Fail(Formatter::Format("allocations in scope", count, "==", "0", 0));
+  }
+  return false;
+}
+
+AllocationPause::AllocationPause()
+: mWasPaused(sAllocations.paused)
+{
+  sAllocations.paused = true;
+}
+
+AllocationPause::~AllocationPause()
+{
+  sAllocations.paused = mWasPaused;
+}
+
+Test::Test(char const* suite, char const* name, bool isBenchmark)
+: mSuite(suite),
+  mName(name),
+  mIsBenchmark(isBenchmark)
+{}
+
+Test::Test(char const* suite, char const* name, SuiteFixtureBase& suiteFixture)
+: Test(suite, name)
+{
+  mSuiteFixture = &suiteFixture;
+}
+
+Test::~Test() = default;
+
+Registration::Registration(TestDescriptor const& descriptor)
+: mDescriptor(descriptor)
+{
+#if !defined XM_DETAIL_USE_SECTION
+  if (sLastRegistration)
+  {
+    sLastRegistration->mNext = this;
+  }
+  else
+  {
+    sFirstRegistration = this;
+  }
+  sLastRegistration = this;
+#endif
+}
+
+TraceSlice::TraceSlice(char const* name)
+: mName(name),
+  mBeginNs(sTracing ? NowNs() : 0)
+{}
+
+TraceSlice::~TraceSlice()
+{
+  if (sTracing)
+  {
+    Trace(TraceEvent::kSlice, nullptr, mName, mBeginNs, NowNs());
+  }
+}
+
+void TraceSlice::Next(char const* name)
+{
+  if (sTracing)
+  {
+    auto now = NowNs();
+    Trace(TraceEvent::kSlice, nullptr, mName, mBeginNs, now);
+    mBeginNs = now;
+  }
+  mName = name;
+}
+
+SuiteFixtureBase::SuiteFixtureBase()
+: mNext(sFirstSuiteFixture)
+{
+  sFirstSuiteFixture = this;
+}
+
+SuiteFixtureBase::~SuiteFixtureBase() = default;
+
+Timeout::Timeout(char const* suite, char const* name, double milliseconds)
+: mSuite(suite),
+  mName(name),
+  mMilliseconds(std::max(milliseconds, .0)),
+  mNext(sFirstTimeout)
+{
+  sFirstTimeout = this;
+}
+
+bool Test::Run()
+{
+  CatchScope catching;
+#if defined XM_HAS_EXCEPTIONS
+  try
+  {
+    RunInternal();
+    return true;
+  }
+#if !defined XM_NO_EXCEPTIONS
+  catch (Exception const& e)
+  {
+    sError = e.message;
+    return false;
+  }
+#endif
+  catch (...)
+  {
+    sError = "Bad exception thrown.";
+    return false;
+  }
+#else
+  RunInternal();  // Failures are left in sFailures.
+  return true;
+#endif
+}
+
+Benchmark::Benchmark(char const* suite, char const* name)
+: Test(suite, name, true)
+{}
+
+void Benchmark::RunInternal()
+{
+  Bench bench;
+  auto runSample = [this, &bench](uint64_t iterations) {
+    bench.mIterations = iterations;
+    bench.mElapsedNs = -1;
+    RunBench(bench);
+    if (bench.mElapsedNs < 0 && sFailures.Count() == 0)
+    {
+      Fail("The benchmark has not iterated over its Bench to completion.");
+    }
+    return double(bench.mElapsedNs);  // negative if it has failed (without exceptions)
+  };
+
+  // Grow the iteration count until a single run takes a sample's worth of time.
+  // Overshoot slightly to avoid falling short repeatedly, but don't grow by more
+  // than 10x at once, in case that a run was cut short by a noisy timer.
+  auto sampleNs = sBenchmarkTime * 1e6 / sBenchmarkSamples;
+  uint64_t iterations = 1;
+  auto elapsed = runSample(iterations);
+  while (elapsed >= .0 && elapsed < sampleNs && iterations < kMaxBenchmarkIterations)
+  {
+    auto multiplier = elapsed > .0 ? std::min(sampleNs * 1.4 / elapsed, 10.) : 10.;
+    iterations = std::min(std::max(uint64_t(iterations * multiplier), iterations + 1),
+      kMaxBenchmarkIterations);
+    elapsed = runSample(iterations);
+  }
+
+  if (elapsed < .0)
+  {
+    return;
+  }
+
+  BenchStats stats;
+  stats.iterations = iterations;
+  bench.mCounters = PerfCounters{};  // of the samples only
+  {
+    AllocationPause pause;
+    stats.samples.reserve(sBenchmarkSamples);
+  }
+  for (unsigned int i = 0; i < sBenchmarkSamples; ++i)
+  {
+    elapsed = runSample(iterations);
+    if (elapsed < .0)
+    {
+      return;
+    }
+    stats.samples.push_back(elapsed / iterations);
+  }
+  stats.itemsPerIteration = bench.mItemsPerIteration;
+  stats.bytesPerIteration = bench.mBytesPerIteration;
+  stats.counters = bench.mCounters;
+
+  AllocationPause pause;
+  stats.Calculate();
+  if (sResult)
+  {
+    sResult->bench = std::move(stats);
+  }
+}
+
+void UseCharPointer(char const volatile*)
+{}
+
+} // detail
+
+Bench::Iterator Bench::begin()
+{
+  if (sPerfCounters)
+  {
+    mStartCounters = ReadPerfCounters();
+  }
+  mStartNs = NowNs();
+  return Iterator{ this, mIterations };
+}
+
+void Bench::Stop()
+{
+  mElapsedNs = NowNs() - mStartNs;
+  if (sPerfCounters)
+  {
+    AddPerfCounters(mStartCounters, ReadPerfCounters(), mCounters);
+  }
+}
+
+} // xm
+
+#if defined XM_TRACK_ALLOCATIONS
+void* operator new(size_t size)
+{
+  return xm::Allocate(size, false);
+}
+
+void* operator new[](size_t size)
+{
+  return xm::Allocate(size, false);
+}
+
+void* operator new(size_t size, std::nothrow_t const&) noexcept
+{
+  return xm::Allocate(size, true);
+}
+
+void* operator new[](size_t size, std::nothrow_t const&) noexcept
+{
+  return xm::Allocate(size, true);
+}
+
+void operator delete(void* p) noexcept
+{
+  xm::Deallocate(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+  xm::Deallocate(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  xm::Deallocate(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+  xm::Deallocate(p);
+}
+
+void operator delete(void* p, std::nothrow_t const&) noexcept
+{
+  xm::Deallocate(p);
+}
+
+void operator delete[](void* p, std::nothrow_t const&) noexcept
+{
+  xm::Deallocate(p);
+}
+#endif // XM_TRACK_ALLOCATIONS
+
+#if defined XM_SELF_TEST
+#include "xm_printers.hpp"
+
+XM_TEST(Xm, FilterMatch)
+{
+  auto filter = [](std::string_view const& filter, std::string_view const& id) {
+    return xm::Filter(filter.data(), filter.data() + filter.size()).Match(id.data(), id.data() + id.size());
+  };
+
+  XM_ASSERT_TRUE(filter("A*", "A"));
+  XM_ASSERT_TRUE(filter("A*", "AB"));
+  XM_ASSERT_TRUE(filter("A*", "ABC"));
+
+  XM_ASSERT_TRUE(filter("*C", "C"));
+  XM_ASSERT_TRUE(filter("*C", "BC"));
+  XM_ASSERT_TRUE(filter("*C", "ABC"));
+
+  XM_ASSERT_TRUE(filter("*C", "CABC"));
+
+  XM_ASSERT_TRUE(filter("A*C", "AC"));
+  XM_ASSERT_TRUE(filter("A*C", "ACBC"));
+  XM_ASSERT_TRUE(filter("A*C", "ABCBCC"));
+
+  XM_ASSERT_TRUE(filter("A*B*C", "ABC"));
+  XM_ASSERT_TRUE(filter("A*B*C", "AABC"));
+  XM_ASSERT_TRUE(filter("A*B*C", "ABBC"));
+  XM_ASSERT_TRUE(filter("A*B*C", "ABCC"));
+  XM_ASSERT_TRUE(filter("A*B*C", "AABBCC"));
+
+  XM_ASSERT_FALSE(filter("B", "AB"));
+  XM_ASSERT_FALSE(filter("B", "BA"));
+  XM_ASSERT_FALSE(filter("B", "ABA"));
+  XM_ASSERT_FALSE(filter("*AB", "ABC"));
+  XM_ASSERT_FALSE(filter("BC*", "ABC"));
+  XM_ASSERT_FALSE(filter("A*C", "AB"));
+
+  XM_ASSERT_TRUE(filter("ABC", "ABC"));
+  XM_ASSERT_TRUE(filter("*", ""));
+  XM_ASSERT_TRUE(filter("**", "A"));
+  XM_ASSERT_TRUE(filter("A*A", "AA"));
+  XM_ASSERT_TRUE(filter("*AAB*", "AAAAB"));
+  XM_ASSERT_TRUE(filter("*ABAB", "ABABAB"));
+  XM_ASSERT_FALSE(filter("ABC", "ABCD"));
+  XM_ASSERT_FALSE(filter("A*A", "A"));
+  XM_ASSERT_TRUE(filter("A*BC*C", "ABCC"));
+  XM_ASSERT_FALSE(filter("A*BC*C", "ABC"));
+
+  std::string id(4096, 'a');  // Would have taken exponential time to backtrack.
+  XM_ASSERT_FALSE(filter("*a*a*a*a*a*a*a*a*b*", id));
+}
+
+XM_TEST(Xm, BenchStats)
+{
+  xm::BenchStats stats;
+  stats.samples = { 4., 1., 3., 2. };
+  stats.Calculate();
+
+  XM_ASSERT_EQ(stats.min, 1.);
+  XM_ASSERT_EQ(stats.median, 2.5);
+  XM_ASSERT_EQ(stats.mean, 2.5);
+  XM_ASSERT_FEQ(stats.stddev, std::sqrt(5. / 3.), 1e-9);
+}
+
+XM_TEST(Xm, ReadBaseline)
+{
+  auto read = [](char const* text, xm::Baseline& baseline) {
+    std::istringstream in(text);
+    return xm::ReadBaseline(in, baseline);
+  };
+
+  xm::Baseline baseline;
+  XM_ASSERT_TRUE(read("A_B 2 1.5 2.5\nA_C 1 3\n", baseline));
+  XM_ASSERT_EQ(baseline.size(), 2u);
+  XM_ASSERT_EQ(baseline["A_B"].size(), 2u);
+  XM_ASSERT_EQ(baseline["A_B"][1], 2.5);
+
+  XM_ASSERT_FALSE(read("A_B 3 1.5 2.5\n", baseline)); // truncated
+  XM_ASSERT_TRUE(baseline.empty());
+  XM_ASSERT_FALSE(read("A_B 18446744073709551615 1\n", baseline));
+  XM_ASSERT_FALSE(read("A_B 0\n", baseline));
+  XM_ASSERT_FALSE(read("A_B 2 1.5 x\n", baseline));
+  XM_ASSERT_FALSE(read("A_B 1 nan\n", baseline));
+  XM_ASSERT_FALSE(read("A_B\n", baseline));
+  XM_ASSERT_TRUE(baseline.empty());
+}
+
+XM_TEST(Xm, MannWhitneyP)
+{
+  std::vector<double> a{ 10., 11., 10.5, 10.2, 10.8, 10.1, 10.9, 10.4 };
+  std::vector<double> b{ 12., 12.5, 11.8, 12.2, 12.9, 12.1, 12.4, 12.6 };
+  XM_ASSERT_LT(xm::MannWhitneyP(a, b), .01);
+  XM_ASSERT_GT(xm::MannWhitneyP(b, a), .99);
+  XM_ASSERT_GT(xm::MannWhitneyP(a, a), .4);
+
+  std::vector<double> same(8, 1.);
+  XM_ASSERT_EQ(xm::MannWhitneyP(same, same), 1.);
+}
+
+XM_TEST(Xm, AssignLongestFirst)
+{
+  auto bins = xm::AssignLongestFirst({ 1., 5., 2., 4., 3. }, 2);
+  XM_ASSERT_EQ(bins.size(), 2u);
+  XM_ASSERT_EQ(bins[0].size(), 3u);
+  XM_ASSERT_EQ(bins[0][0], 1u); // 5
+  XM_ASSERT_EQ(bins[0][1], 2u); // 2
+  XM_ASSERT_EQ(bins[0][2], 0u); // 1
+  XM_ASSERT_EQ(bins[1].size(), 2u);
+  XM_ASSERT_EQ(bins[1][0], 3u); // 4
+  XM_ASSERT_EQ(bins[1][1], 4u); // 3
+}
+
+XM_TEST(Xm, Shuffle)
+{
+  int values[10];
+  for (int i = 0; i < 10; ++i)
+  {
+    values[i] = i;
+  }
+
+  xm::Rng rng(7);
+  xm::Shuffle(values, values + 10, rng);
+  int shuffled[10];
+  std::copy(values, values + 10, shuffled);
+
+  std::sort(values, values + 10);
+  for (int i = 0; i < 10; ++i)
+  {
+    XM_ASSERT_EQ(values[i], i);
+  }
+
+  xm::Rng again(7);
+  xm::Shuffle(values, values + 10, again);
+  XM_ASSERT_RANGE_EQ(values, shuffled);
+}
+
+XM_TEST(Xm, FailureArena)
+{
+  xm::FailureArena arena;
+  std::string big(5000, 'x');
+  arena.Add("first");
+  arena.Add(big.c_str());
+  arena.Add("third");
+  XM_ASSERT_EQ(arena.Count(), 3u);
+
+  std::string str;
+  arena.AppendTo(str);
+  XM_ASSERT_EQ(str, "first\n" + big + "\nthird");
+
+  arena.Reset();
+  arena.Add("again");
+  str.clear();
+  arena.AppendTo(str);
+  XM_ASSERT_EQ(str, std::string("again"));
+}
 
-  XM_ASSERT_TRUE(filter("*C", "C"));
-  XM_ASSERT_TRUE(filter("*C", "BC"));
-  XM_ASSERT_TRUE(filter("*C", "ABC"));
+XM_TEST(Xm, MessageArena)
+{
+  xm::MessageArena arena;
+  std::ostream stream(&arena);
+  std::string big(3000, 'x');
+  arena.Begin();
+  stream << "short";
+  auto shortMessage = arena.End();
+  arena.Begin();
+  stream << big;
+  auto bigMessage = arena.End();
+  XM_ASSERT_STREQ(shortMessage, "short");
+  XM_ASSERT_STREQ(bigMessage, big);
 
-  XM_ASSERT_TRUE(filter("*C", "CABC"));
+  auto limit = xm::sMessageLimit;
+  xm::sMessageLimit = 2048;
+  arena.Reset();
+  std::ostream truncated(&arena);
+  arena.Begin();
+  truncated << big;
+  auto size = strlen(arena.End());
+  xm::sMessageLimit = limit;
+  XM_ASSERT_GT(size, 0u);
+  XM_ASSERT_LT(size, big.size());
+}
 
-  XM_ASSERT_TRUE(filter("A*C", "AC"));
-  XM_ASSERT_TRUE(filter("A*C", "ACBC"));
-  XM_ASSERT_TRUE(filter("A*C", "ABCBCC"));
+XM_TEST(Xm, FindMismatch)
+{
+  std::vector<uint8_t> a(10000, 1);
+  auto b = a;
+  XM_ASSERT_EQ(xm::detail::FindMismatch(a.data(), b.data(), a.size()), a.size());
+  b[5000] = 2;
+  XM_ASSERT_EQ(xm::detail::FindMismatch(a.data(), b.data(), a.size()), 5000u);
+  b[9999] = 2;
+  XM_ASSERT_EQ(xm::detail::FindMismatch(a.data() + 6000, b.data() + 6000, 4000), 3999u);
 
-  XM_ASSERT_TRUE(filter("A*B*C", "ABC"));
-  XM_ASSERT_TRUE(filter("A*B*C", "AABC"));
-  XM_ASSERT_TRUE(filter("A*B*C", "ABBC"));
-  XM_ASSERT_TRUE(filter("A*B*C", "ABCC"));
-  XM_ASSERT_TRUE(filter("A*B*C", "AABBCC"));
+  int c[] = { 1, 2, 3 };
+  std::vector<int> d{ 1, 2, 3 };
+  XM_ASSERT_RANGE_EQ(c, d);
+}
 
-  XM_ASSERT_FALSE(filter("B", "AB"));
-  XM_ASSERT_FALSE(filter("B", "BA"));
-  XM_ASSERT_FALSE(filter("B", "ABA"));
-  XM_ASSERT_FALSE(filter("*AB", "ABC"));
-  XM_ASSERT_FALSE(filter("BC*", "ABC"));
-  XM_ASSERT_FALSE(filter("A*C", "AB"));
+XM_TEST(Xm, PrintBytes)
+{
+  uint8_t bytes[70];
+  for (size_t i = 0; i < sizeof(bytes); ++i)
+  {
+    bytes[i] = uint8_t(i * 7);
+  }
+
+  std::ostringstream stream;
+  xm::detail::PrintBytes(bytes, 3, stream);
+  XM_ASSERT_EQ(stream.str(), "00 07 0e ");
+
+  auto limit = xm::sMaxBytesPrinted;
+  xm::sMaxBytesPrinted = 66;
+  stream.str("");
+  xm::detail::PrintBytes(bytes, sizeof(bytes), stream);
+  xm::sMaxBytesPrinted = limit;
+  auto str = stream.str();
+  XM_ASSERT_EQ(str.size(), 66u * 3 + 3);
+  XM_ASSERT_EQ(str[64 * 3 - 1], '\n');
+  XM_ASSERT_EQ(str.substr(64 * 3), "c0 c7 ...");
+}
+
+namespace
+{
+struct XmPoint
+{
+  int x, y;
+};
+
+std::ostream& operator<<(std::ostream& os, XmPoint const& p)
+{
+  return os << "(" << p.x << ", " << p.y << ")";
+}
+
+struct XmOpaque
+{
+  uint8_t byte;
+};
+}
+
+XM_TEST(Xm, ValuePrinter)
+{
+  using xm::detail::Formatter;
+  XM_ASSERT_EQ(std::string_view(Formatter::Format("p", XmPoint{ 1, 2 }, "==", "q", XmPoint{ 3, 4 })),
+    "Expected: p (which is (1, 2)) == q (which is (3, 4))");
+  XM_ASSERT_EQ(std::string_view(Formatter::Format("a", XmOpaque{ 0x1f }, "==", "b", XmOpaque{ 0 })),
+    "Expected: a (which is 1f ) == b (which is 00 )");
+  XM_ASSERT_EQ(std::string_view(Formatter::Format("n", 5, "<", "4", 4)),
+    "Expected: n (which is 5) < 4");
+  XM_ASSERT_EQ(std::string_view(Formatter::Format("s", std::string("a"), "==", "t", "b")),
+    "Expected: s (which is \"a\") == t (which is \"b\")");
+  XM_ASSERT_EQ(std::string_view(Formatter::Format("p", static_cast<int*>(nullptr), "!=", "nullptr", nullptr)),
+    "Expected: p (which is nullptr) != nullptr");
+
+  int const a[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+  std::vector<int> b(std::begin(a), std::end(a));
+  b[5] = 0;
+  XM_ASSERT_EQ(std::string_view(Formatter::FormatRangeMismatch("a", a, 9, "b", b, 9, 5)),
+    "Expected: a == b, element-wise (sizes: 9, 9); first mismatch at [5]:"
+    "\n  a[2..]: 3 4 5 >6< 7 8 9"
+    "\n  b[2..]: 3 4 5 >0< 7 8 9");
+}
+
+struct XmSuiteFixture
+{
+  static int sInstances;
+
+  XmSuiteFixture() { ++sInstances; }
+  ~XmSuiteFixture() { --sInstances; }
+};
+
+int XmSuiteFixture::sInstances = 0;
+
+XM_TEST_SF(XmSuiteFixture, Shared1)
+{
+  XM_ASSERT_EQ(XmSuiteFixture::sInstances, 1);
+}
+
+XM_TEST_SF(XmSuiteFixture, Shared2)
+{
+  XM_ASSERT_EQ(XmSuiteFixture::sInstances, 1);
+}
+
+XM_TEST_P(Xm, Range, xm::Values(xm::Range(0, 7, 3), xm::Range(6, -1, -3)))
+{
+  int sum = 0;
+  int count = 0;
+  for (auto v : param)
+  {
+    sum += v;
+    ++count;
+  }
+  XM_ASSERT_EQ(count, 3);
+  XM_ASSERT_EQ(sum, 9);
+}
+
+XM_TYPED_TEST(Xm, RangeEmpty, int, unsigned char, long long)
+{
+  XM_ASSERT_FALSE(xm::Range<TypeParam>(3, 3).begin() != xm::Range<TypeParam>(3, 3).end());
+  XM_ASSERT_FALSE(xm::Range<TypeParam>(4, 3).begin() != xm::Range<TypeParam>(4, 3).end());
+}
+
+XM_TEST(Xm, RegistryOrder)
+{
+  int line = 0;
+  bool found = false;
+  for (auto d : xm::detail::GetRegistry())
+  {
+    if (strcmp(d->file, __FILE__) == 0)
+    {
+      XM_ASSERT_LT(line, d->line);
+      line = d->line;
+      found = found || strcmp(d->name, "RegistryOrder") == 0;
+    }
+  }
+  XM_ASSERT_TRUE(found);
+}
+
+XM_TEST(Xm, GenShrink)
+{
+  auto candidates = xm::gen::Int<int>().Shrink(100);
+  XM_ASSERT_RANGE_EQ(candidates, (std::vector<int>{ 0, 50, 75, 88, 94, 97, 99 }));
+  XM_ASSERT_TRUE(xm::gen::Int<int>(5, 10).Shrink(5).empty());
+  XM_ASSERT_EQ(xm::gen::Int<int>(-10, -5).Shrink(-7).front(), -5);
+
+  auto strings = xm::gen::String(8, 'a', 'z').Shrink("ab");
+  XM_ASSERT_RANGE_EQ(strings, (std::vector<std::string>{ "", "a", "b", "b", "a", "aa" }));
+}
+
+XM_PROPERTY(Xm, GenBounds, xm::gen::Int<int8_t>(-5, 7), xm::gen::Vector(xm::gen::Float<float>(1.f, 2.f), 4))
+{
+  auto const& [i, floats] = args;
+  XM_ASSERT_GE(i, -5);
+  XM_ASSERT_LE(i, 7);
+  XM_ASSERT_LE(floats.size(), 4u);
+  for (auto f : floats)
+  {
+    XM_ASSERT_GE(f, 1.f);
+    XM_ASSERT_LE(f, 2.f);
+  }
+}
+
+XM_TEST(Xm, ThreadGuard)
+{
+  std::atomic<int> numRun{ 0 };
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i)
+  {
+    threads.push_back(xm::Spawn([&numRun](int n) {
+      XM_ASSERT_LT(n, 4);
+      ++numRun;
+    }, i));
+  }
+
+  for (auto& t : threads)
+  {
+    t.join();
+  }
+  XM_ASSERT_EQ(numRun.load(), 4);
+
+  xm::ThreadGuard guard;
+  xm::detail::AllocationPause pause;  // the thread's state is freed by the thread.
+  std::thread([&guard, &numRun] { guard.Run([&numRun] { XM_EXPECT_EQ(++numRun, 5); }); }).join();
+
+  // Failures on a spawned thread are those of the test it's spawned for.
+  {
+    xm::detail::TestContext context;
+    auto outer = xm::sContext;
+    xm::sContext = &context;
+    auto thread = xm::Spawn([] { XM_EXPECT_EQ(1, 2); });
+    xm::sContext = outer;
+    thread.join();
+    XM_ASSERT_TRUE(context.HasFailures());
+    std::string error;
+    context.AppendTo(error);
+    XM_ASSERT_EQ(error, "Expected: 1 == 2");
+  }
+
+  // So are those on a thread without a ThreadGuard, while it's the only test running.
+  std::unique_lock<std::mutex> lock(xm::sSoleContextMutex);
+  if (xm::sSoleContext && xm::sNumRunWorkers == 1)
+  {
+    xm::detail::TestContext context;
+    auto outer = xm::sSoleContext;
+    xm::sSoleContext = &context;
+    lock.unlock();
+    std::thread([] { XM_EXPECT_EQ(1, 3); }).join();
+    lock.lock();
+    xm::sSoleContext = outer;
+    lock.unlock();
+    XM_ASSERT_TRUE(context.HasFailures());
+    std::string error;
+    context.AppendTo(error);
+    XM_ASSERT_EQ(error, "Expected: 1 == 3");
+  }
+}
+
+namespace
+{
+struct PooledFixture
+{
+  static thread_local int sNumConstructed;
+  static thread_local int sNumResets;
+
+  PooledFixture() { ++sNumConstructed; }
+
+  void Reset() { ++sNumResets; }
+};
+
+thread_local int PooledFixture::sNumConstructed = 0;
+thread_local int PooledFixture::sNumResets = 0;
+}
+
+XM_TEST(Xm, FixturePool)
+{
+  static_assert(xm::detail::HasReset<PooledFixture>::value);
+  static_assert(!xm::detail::HasReset<xm::Rng>::value);
+
+  auto numUses = PooledFixture::sNumConstructed + PooledFixture::sNumResets;
+  for (int i = 0; i < 3; ++i)
+  {
+    xm::detail::Fixture<PooledFixture> f;
+  }
+  XM_ASSERT_EQ(PooledFixture::sNumConstructed, 1);
+  XM_ASSERT_EQ(PooledFixture::sNumConstructed + PooledFixture::sNumResets, numUses + 3);
+}
+
+XM_TEST(Xm, TraceBuffer)
+{
+  xm::TraceBuffer* buffer = nullptr;
+  {
+    xm::detail::AllocationPause pause;  // the buffer is freed here, not by the thread.
+    std::thread([&buffer] {
+      for (int64_t i = 0; i < int64_t(xm::TraceBuffer::kSize) + 3; ++i)
+      {
+        xm::Trace(xm::TraceEvent::kSlice, nullptr, "slice", i, i + 1);
+      }
+      buffer = xm::sTraceBuffer.buffer;
+    }).join();
+  }
+
+  std::unique_ptr<xm::TraceBuffer> owned;
+  {
+    std::lock_guard<std::mutex> lock(xm::sTraceMutex);
+    auto i = std::find_if(xm::sTraceBuffers.begin(), xm::sTraceBuffers.end(),
+      [buffer](std::unique_ptr<xm::TraceBuffer> const& b) { return b.get() == buffer; });
+    XM_ASSERT_TRUE(i != xm::sTraceBuffers.end());
+    owned = std::move(*i);
+    xm::sTraceBuffers.erase(i);
+  }
+
+  xm::detail::AllocationPause pause;
+  XM_ASSERT_TRUE(owned->retired);
+  XM_ASSERT_EQ(owned->count, xm::TraceBuffer::kSize + 3);
+  XM_ASSERT_EQ(owned->events[0].beginNs, int64_t(xm::TraceBuffer::kSize));
+  XM_ASSERT_EQ(owned->events[3].beginNs, 3);
+  owned.reset();
+}
+
+XM_TEST(Xm, ResourceUsage)
+{
+  auto begin = xm::SampleUsage();
+  volatile uint64_t sum = 0;
+  for (int i = 0; i < 100000; ++i)
+  {
+    sum = sum + uint64_t(i);
+  }
+  auto usage = xm::GetUsageSince(begin);
+  XM_ASSERT_GE(usage.userMs, .0);
+  XM_ASSERT_GE(usage.systemMs, .0);
+  XM_ASSERT_GE(xm::SampleUsage().peakRss, begin.peakRss);
+}
+
+XM_TEST(Xm, PerfCounters)
+{
+  auto begin = xm::ReadPerfCounters();
+  volatile uint64_t sum = 0;
+  for (int i = 0; i < 1000; ++i)
+  {
+    sum = sum + uint64_t(i);
+  }
+  auto end = xm::ReadPerfCounters();
+  XM_ASSERT_EQ(begin.available, end.available);
+
+  xm::PerfCounters counters;
+  xm::AddPerfCounters(begin, end, counters);
+  xm::AddPerfCounters(begin, end, counters);
+  XM_ASSERT_EQ(counters.available, end.available);
+  for (auto& info : xm::kPerfCounters)
+  {
+    XM_ASSERT_GE(end.*info.count, begin.*info.count);
+    XM_ASSERT_EQ(counters.*info.count, (end.*info.count - begin.*info.count) * 2);
+  }
+}
+
+#if defined XM_TRACK_ALLOCATIONS
+XM_TEST(Xm, AllocationTracking)
+{
+  XM_ASSERT_NO_ALLOCS {}
+  XM_ASSERT_MAX_ALLOCS(0);
+
+  auto p = new int(1);
+  xm::DoNotOptimize(p);
+  XM_ASSERT_MAX_ALLOCS(1);
+  delete p;
 }
+#endif
 
 #endif // XM_SELF_TEST
+
+#if defined XM_SELF_BENCH
+// Benchmarks of the overhead of the framework itself, over a suite of synthetic
+// tests; see "Self-benchmarks" in the README.
+#ifndef XM_SELF_BENCH_TESTS
+#define XM_SELF_BENCH_TESTS 10000
+#endif
+
+namespace
+{
+constexpr int kXmSyntheticTests = XM_SELF_BENCH_TESTS;
+
+// The names of tests that the filter benchmarks match, long and repetitive enough
+// for the wildcards to have to try many positions. Made once, off the books of the
+// benchmarks.
+std::vector<std::string> const& GetXmSyntheticNames()
+{
+  xm::detail::AllocationPause pause;
+  static auto const names = []() {
+    std::vector<std::string> names;
+    names.reserve(kXmSyntheticTests);
+    for (int i = 0; i < kXmSyntheticTests; ++i)
+    {
+      names.push_back("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa/" + std::to_string(i));
+    }
+    return names;
+  }();
+  return names;
+}
+
+// Swaps in the filters of @a filterStr for the lifetime of the object, then restores
+// those of the run.
+class XmFilterScope
+{
+public:
+  explicit XmFilterScope(char const* filterStr)
+  {
+    mInclude.swap(xm::sIncludeFilters);
+    mExclude.swap(xm::sExcludeFilters);
+    xm::SetFilter(filterStr);
+  }
+
+  ~XmFilterScope()
+  {
+    mInclude.swap(xm::sIncludeFilters);
+    mExclude.swap(xm::sExcludeFilters);
+  }
+
+private:
+  std::vector<xm::Filter> mInclude;
+  std::vector<xm::Filter> mExclude;
+};
+
+void XmBenchFilter(xm::Bench& bench, char const* filterStr)
+{
+  auto& names = GetXmSyntheticNames();
+  XmFilterScope filter(filterStr);
+  {
+    // IsAllowed() keeps a buffer for the id, which grows to the longest one once.
+    xm::detail::AllocationPause pause;
+    xm::IsAllowed("XmSynthetic", names.back().c_str());
+  }
+
+  size_t allowed = 0;
+  for (auto _ : bench)
+  {
+    for (auto& name : names)
+    {
+      allowed += xm::IsAllowed("XmSynthetic", name.c_str());
+    }
+  }
+  xm::DoNotOptimize(allowed);
+  bench.SetItemsPerIteration(double(names.size()));
+}
+
+#ifndef _WIN32
+// A stream to a pipe, which a thread drains, so that reporters write to it as they
+// would to a pager or a CI log collector.
+class XmPipe : public std::streambuf
+{
+public:
+  XmPipe()
+  : mStream(this)
+  {
+    setp(mBuffer, mBuffer + sizeof(mBuffer));
+    xm::detail::AllocationPause pause;
+    if (pipe(mFds) == 0)
+    {
+      mDrain = std::thread([fd = mFds[0]]() {
+        char buffer[sizeof(mBuffer)];
+        while (read(fd, buffer, sizeof(buffer)) > 0)
+        {}
+      });
+    }
+  }
+
+  ~XmPipe()
+  {
+    sync();
+    xm::detail::AllocationPause pause;
+    if (mDrain.joinable())
+    {
+      close(mFds[1]);
+      mDrain.join();
+      close(mFds[0]);
+    }
+  }
+
+  bool IsOpen() const { return mDrain.joinable(); }
+
+  std::ostream& Stream() { return mStream; }
+
+protected:
+  int_type overflow(int_type c) override
+  {
+    if (sync() != 0)
+    {
+      return traits_type::eof();
+    }
+
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync() override
+  {
+    bool written = xm::WriteAll(mFds[1], pbase(), size_t(pptr() - pbase()));
+    setp(mBuffer, mBuffer + sizeof(mBuffer));
+    return written ? 0 : -1;
+  }
+
+private:
+  char mBuffer[4096];
+  int mFds[2] = { -1, -1 };
+  std::thread mDrain;
+  std::ostream mStream;
+};
+
+// Reports a passed test per iteration, and a failed one per 16, to @a reporter.
+void XmBenchReporter(xm::Bench& bench, xm::Reporter& reporter)
+{
+  char const* const error = "Expected: a (which is 1) == b (which is 2)";
+  xm::TestResult result{ "XmSynthetic", "Report", true, 0.25, nullptr, nullptr, 1,
+    nullptr, nullptr, nullptr };
+  uint64_t i = 0;
+  for (auto _ : bench)
+  {
+    result.passed = (++i & 15) != 0;
+    result.error = result.passed ? nullptr : error;
+    reporter.OnTestStarted(result.suite, result.name);
+    reporter.OnTestFinished(result);
+  }
+  reporter.OnSuiteFinished(result.suite);
+}
+#endif
+}
+
+// The tests whose registration, enumeration and scheduling is measured; run them
+// with different --jobs to find how well the runner scales.
+XM_TEST_P(XmSynthetic, Test, xm::Range(0, kXmSyntheticTests))
+{
+  uint64_t hash = uint64_t(param);
+  for (int i = 0; i < 256; ++i)
+  {
+    hash = (hash ^ uint64_t(i)) * 1099511628211ull;
+  }
+  XM_EXPECT_NE(hash, 0u);
+}
+
+XM_BENCH(XmBench, OrderRegistry)
+{
+  // Descriptors of synthetic tests over a few files, as a linker may leave them.
+  char const* const files[] = { "a.cpp", "b.cpp", "c.cpp", "d.cpp", "e.cpp", "f.cpp",
+    "g.cpp", "h.cpp" };
+  std::vector<xm::detail::TestDescriptor> descriptors;
+  for (int i = 0; i < kXmSyntheticTests; ++i)
+  {
+    descriptors.push_back({ "XmSynthetic", "Test", nullptr, false,
+      files[i % std::size(files)], kXmSyntheticTests - i });
+  }
+
+  std::vector<xm::detail::TestDescriptor const*> registry;
+  for (auto _ : bench)
+  {
+    registry.clear();
+    for (auto& d : descriptors)
+    {
+      registry.push_back(&d);
+    }
+    xm::detail::OrderByDeclaration(registry);
+    xm::DoNotOptimize(registry.data());
+  }
+  bench.SetItemsPerIteration(double(descriptors.size()));
+}
+
+XM_BENCH(XmBench, EnumerateTests)
+{
+  XmFilterScope filter("XmSynthetic*");
+  size_t allowed = 0;
+  for (auto _ : bench)
+  {
+    xm::detail::Runner::ForEachAllowed([&allowed](xm::detail::Test&) { ++allowed; }, []() {});
+  }
+  xm::DoNotOptimize(allowed);
+  bench.SetItemsPerIteration(double(kXmSyntheticTests));
+}
+
+XM_BENCH(XmBench, FilterLiteral)
+{
+  XmBenchFilter(bench, "XmSynthetic_aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa/1");
+}
+
+XM_BENCH(XmBench, FilterWildcards)
+{
+  XmBenchFilter(bench, "*a*a*a*a*a*a*a*a*b:Xm*aaaa*aaaa*/9*9:*a/-*0");
+}
+
+XM_BENCH(XmBench, SetFilter)
+{
+  XmFilterScope filter(nullptr);
+  for (auto _ : bench)
+  {
+    xm::SetFilter("*a*a*a*a*a*a*a*a*b:Xm*aaaa*aaaa*/9*9:*a/-*0");
+    xm::DoNotOptimize(xm::sIncludeFilters.data());
+  }
+}
+
+XM_BENCH(XmBench, AssertionPass)
+{
+  int a = 1;
+  for (auto _ : bench)
+  {
+    xm::DoNotOptimize(a);
+    XM_EXPECT_EQ(a, 1);
+  }
+}
+
+XM_BENCH(XmBench, AssertionFail)
+{
+  // The formatting of the message, which is the cost of a failed assertion beyond
+  // recording it (which would fail the benchmark).
+  int a = 1;
+  std::string b("abc");
+  for (auto _ : bench)
+  {
+    xm::DoNotOptimize(a);
+    xm::DoNotOptimize(xm::detail::Formatter::Format("a", a, "==", "b.size()", b.size()));
+    xm::sMessages.Reset();  // as each test starts
+  }
+}
+
+#ifndef _WIN32
+XM_BENCH(XmBench, ReportConsole)
+{
+  XmPipe pipe;
+  XM_ASSERT_TRUE(pipe.IsOpen());
+  auto output = xm::sOutput;
+  xm::SetOutput(pipe.Stream());
+  {
+    xm::ConsoleReporter reporter;
+    XmBenchReporter(bench, reporter);
+  }
+  xm::SetOutput(*output);
+}
+
+XM_BENCH(XmBench, ReportJsonLines)
+{
+  XmPipe pipe;
+  XM_ASSERT_TRUE(pipe.IsOpen());
+  xm::JsonLinesReporter reporter(pipe.Stream());
+  XmBenchReporter(bench, reporter);
+}
+
+XM_BENCH(XmBench, ReportTap)
+{
+  XmPipe pipe;
+  XM_ASSERT_TRUE(pipe.IsOpen());
+  xm::TapReporter reporter(pipe.Stream());
+  XmBenchReporter(bench, reporter);
+}
+#endif
+
+#endif // XM_SELF_BENCH
@@ -7,17 +7,30 @@
 // Refer to http://unlicense.org/ for licensing information.
 //
 //==============================================================================
-#include <iostream>
-#include <sstream>
-#include <algorithm>
+#include <iosfwd>
 #include <cstring>
 #include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 // Compiler identification
 #if defined(_MSC_VER)
 #define XM_COMPILER_MSVC
 #endif
 
+// Failure handling. XM_NO_EXCEPTIONS selects the exception-free path, where failed
+// assertions return from the function they're in; it's implied when compiling
+// without exceptions.
+#if defined(__cpp_exceptions) || defined(_CPPUNWIND)
+#define XM_HAS_EXCEPTIONS
+#elif !defined(XM_NO_EXCEPTIONS)
+#define XM_NO_EXCEPTIONS
+#endif
+
 // Diagnostics control
 #if defined(XM_COMPILER_MSVC)
 #define XM_MSVC_WARNING(x) __pragma(warning(x))
@@ -35,14 +48,156 @@
 /// Using eXaM, your interaction will mainly be with the functions in the 'xm'
 /// namespace (outside of 'detail'), and the macros at the bottom. Refer to the
 /// XM_TEST() and XM_TEST_F() macros for declaring and defining test cases and
-/// the XM_ASSERT_*() macros for the actual checks.
+/// the XM_ASSERT_*() and XM_EXPECT_*() macros for the actual checks.
 namespace xm
 {
 
+///@brief The events counted on the thread of a test while it ran, when enabled with
+/// SetPerfCounters(). On Linux they're read from perf_event_open() and getrusage();
+/// elsewhere - or where a counter isn't permitted or supported - only what can be
+/// had portably is counted, and @e available tells which of them were.
+struct PerfCounters
+{
+  enum Counter : uint32_t
+  {
+    kCycles = 1 << 0,
+    kInstructions = 1 << 1,
+    kCacheMisses = 1 << 2,
+    kBranchMisses = 1 << 3,
+    kContextSwitches = 1 << 4,
+  };
+
+  uint32_t available = 0; // the mask of the Counters that were counted.
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  uint64_t cacheMisses = 0;
+  uint64_t branchMisses = 0;
+  uint64_t contextSwitches = 0;
+};
+
+///@brief The statistics of the time per iteration of a benchmark, in nanoseconds.
+struct BenchmarkResult
+{
+  uint64_t iterations = 0;  // per sample
+  size_t numSamples = 0;
+  double mean = .0;
+  double median = .0;
+  double stddev = .0;
+  double min = .0;
+  double itemsPerIteration = .0;
+  double bytesPerIteration = .0;
+  PerfCounters counters;  // of the timed loops of the samples, in total.
+};
+
+///@brief The heap allocations that a test has made through operator new, counted
+/// when xm.cpp is compiled with XM_TRACK_ALLOCATIONS defined. Allocations made by
+/// other threads, and over-aligned ones, are not counted.
+struct AllocationStats
+{
+  size_t count = 0;
+  size_t bytes = 0; // in total
+  size_t peakBytes = 0; // live at once
+  size_t leakedBytes = 0; // still live once the test has returned
+};
+
+///@brief The CPU time and memory that a test has used. The CPU times are those of
+/// its thread on Linux and Windows, and of the process elsewhere. The peak resident
+/// set is that of the process, so its growth is put down to the tests that raised it.
+struct ResourceUsage
+{
+  double userMs = .0;
+  double systemMs = .0;
+  size_t peakRssGrowth = 0; // bytes
+};
+
+///@brief The outcome of a test, as passed to Reporter::OnTestFinished().
+struct TestResult
+{
+  char const* suite;
+  char const* name;
+  bool passed;
+  double duration;  // milliseconds of wall time, from a steady clock
+  char const* error;  // the reason of failure, if known; nullptr otherwise.
+  BenchmarkResult const* benchmark; // nullptr unless the test was a benchmark.
+  size_t assertions;  // the number of assertions checked.
+  AllocationStats const* allocations; // nullptr unless allocations are tracked.
+  PerfCounters const* counters; // nullptr unless enabled, and any were available.
+  ResourceUsage const* usage;
+};
+
+///@brief The totals of a test run, as passed to Reporter::OnRunFinished().
+struct Tally
+{
+  size_t run;
+  size_t passed;
+  size_t ignored;
+  size_t errors;  // of the run itself, e.g. a shard without tests, which fail it.
+};
+
+///@brief Receives the progress of RunTests(). Events are sent from a single thread
+/// and in the order of declaration of the tests, regardless of concurrency.
+class Reporter
+{
+public:
+  virtual ~Reporter();
+
+  ///@brief Called before the first test is run, with the number of tests that
+  /// were allowed through the filters.
+  virtual void OnRunStarted(size_t /*numTests*/) {}
+
+  virtual void OnSuiteStarted(char const* /*suite*/) {}
+
+  virtual void OnTestStarted(char const* /*suite*/, char const* /*name*/) {}
+
+  virtual void OnTestFinished(TestResult const& /*result*/) {}
+
+  virtual void OnSuiteFinished(char const* /*suite*/) {}
+
+  ///@brief Called with diagnostic messages that aren't tied to any test.
+  virtual void OnMessage(char const* /*message*/) {}
+
+  virtual void OnRunFinished(Tally const& /*tally*/) {}
+};
+
 ///@brief Sets @a output as the stream where messages are sent (stdout by default).
 ///@note The Windows version only supports coloured output on stdout and stderr.
+///@note The default reporter batches its output, and only writes and flushes it on
+/// failures, at the end of suites, once a sizable amount has accumulated, or when
+/// some time has passed.
 void SetOutput(std::ostream& output);
 
+///@brief Sets the most memory, in bytes, that the failure messages of a test may
+/// take up, per thread (1MB by default). Messages that exceed it are truncated.
+void SetMessageLimit(size_t bytes);
+
+///@brief Sets the most bytes of values printed in failure messages, as a hex dump,
+/// where they can't be printed otherwise (64 by default).
+void SetMaxBytesPrinted(size_t bytes);
+
+///@brief Sets @a reporter to send the progress of RunTests() to, in place of the
+/// default, which prints it to the output stream (see SetOutput()). nullptr
+/// restores the default.
+///@note The lifetime of @a reporter must extend until RunTests() has returned.
+void SetReporter(Reporter* reporter);
+
+///@brief Adds @a reporter to send the progress of RunTests() to, in addition to
+/// the one set by SetReporter() (or the default).
+///@note The lifetime of @a reporter must extend until RunTests() has returned.
+void AddReporter(Reporter& reporter);
+
+///@brief Machine readable formats that results may be streamed in.
+enum class ReportFormat
+{
+  kJUnitXml,
+  kJsonLines,
+  kTap,
+};
+
+///@brief Sets the path of a file to stream the results to in the given @a format,
+/// alongside the output of the reporter(s). Each result is written as soon as the test
+/// has finished. nullptr or an empty string disables it.
+void SetReportFile(ReportFormat format, char const* path);
+
 ///@brief Allows specifying inclusion and exclusion filters, which tests' suite
 /// and name is checked against.
 ///@par Tests' names must be valid C++ identifiers, so it makes sense to include only
@@ -56,6 +211,180 @@ void SetOutput(std::ostream& output);
 ///@note Filters set by a previous call are discarded.
 void SetFilter(char const* filterStr);
 
+///@brief Sets the number of worker threads that RunTests() distributes the tests
+/// across. 0 uses as many workers as there are hardware threads; 1 (the default)
+/// runs the tests on the calling thread.
+///@note Tests will run concurrently and so must not share unsynchronised state.
+/// Their results are still reported in the order of declaration.
+void SetConcurrency(unsigned int numThreads);
+
+///@brief Sets whether to run tests in child processes, which are forked from the
+/// test runner, so that a test crashing or exiting only fails that test, and the
+/// run carries on. Each worker (see SetConcurrency()) keeps a child process, which
+/// is forked once and runs tests until it crashes, then gets replaced.
+///@note Tests in the same child process may still affect each other. Not supported
+/// on Windows, where tests keep running in-process.
+void SetIsolation(bool isolate);
+
+///@brief Sets whether to count the cycles, instructions, cache and branch misses,
+/// and context switches of each test, and of the timed loops of benchmarks (see
+/// PerfCounters), which are reported along with their durations. Only the thread of
+/// the test is counted; the hardware counters are those of user space.
+///@note On Linux, perf_event_paranoid may need lowering (to 2 or below) for the
+/// hardware counters to be available; on Windows, only the cycles are counted.
+void SetPerfCounters(bool enable);
+
+///@brief Sets the path of a file that a timeline of the run is written to at the end
+/// of RunTests(), in the Chrome trace event format, which chrome://tracing and
+/// Perfetto open: a slice per test on the thread that ran it, with the setup, body
+/// and teardown of fixtures nested in it, and a marker where tests have failed. The
+/// events are kept in a buffer per thread, of the latest 16384. An empty path - the
+/// default - disables tracing.
+///@note Under process isolation, only the tests themselves are traced.
+void SetTraceFile(char const* path);
+
+///@brief Splits the tests that were allowed through the filters into @a count
+/// shards, and only runs the one at @a index, which must be less than @a count.
+/// Tests are assigned to shards by a stable hash of their id - or by expected duration
+/// if there's a timing cache (see SetTimingCache()) -, so every shard runs the same
+/// tests given the same test binary, filters and timing cache. A @a count of 0 or 1
+/// disables sharding.
+///@note If SetShard() hasn't been called, the XM_SHARD_INDEX and XM_SHARD_COUNT
+/// environment variables are used, if set.
+void SetShard(unsigned int index, unsigned int count);
+
+///@brief Sets the path of a file that a JSON summary of the shard (its index and
+/// count, the totals and the ids of the failed tests) is written to at the end of
+/// RunTests(), for merging the results of shards. The XM_SHARD_SUMMARY environment
+/// variable is used if this hasn't been called.
+void SetShardSummary(char const* path);
+
+///@brief Sets the path of a binary file, which the durations and outcomes of tests
+/// are kept in across runs. When it's present, parallel runs hand out the tests in longest
+/// first order, balancing the expected load of workers, and SetShard() assigns tests
+/// to shards so as to balance their expected duration (which is only consistent if
+/// all shards use the same file).
+void SetTimingCache(char const* path);
+
+///@brief Sets the number of the slowest tests that are listed, with their CPU time,
+/// after the totals at the end of RunTests() (5 by default; 0 lists none).
+void SetSlowestCount(unsigned int count);
+
+///@brief Sets whether to stop running tests after the first failure. Tests that
+/// haven't been reported by then are not run, or their results are discarded.
+void SetFailFast(bool failFast);
+
+///@brief Sets the number of times that each test is run (1 by default). The repeats
+/// of a test run at the same time, on all cores - or the number of threads set with
+/// SetConcurrency() -, in the same process, other than those of suite fixtures, which
+/// run one after the other; benchmarks aren't repeated. Each test is reported once,
+/// with the number of its repeats that failed, the first of them, and the
+/// distribution of their durations.
+void SetRepeat(unsigned int count);
+
+///@brief Sets whether to stop repeating a test once a repeat has failed (see
+/// SetRepeat()). Unless a repeat count is set, tests are repeated until they fail.
+void SetUntilFail(bool untilFail);
+
+///@brief Sets whether to run the tests in a random order, which is determined by
+/// @a seed; 0 picks a seed at random, which is printed.
+void SetShuffle(bool shuffle, uint64_t seed = 0);
+
+///@brief Sets whether RunTests() only lists the ids of the tests that pass the
+/// filters, one per line, to the output (see SetOutput()), rather than running them.
+/// Only the tests of groups, e.g. XM_TEST_P(), are created for this.
+void SetListOnly(bool listOnly);
+
+///@brief Sets the time, in milliseconds, after which a test is deemed hung, unless
+/// it's given a timeout of its own, using XM_TIMEOUT(). 0 - the default - means no
+/// timeout. Under process isolation (see SetIsolation()), the child running a test
+/// that times out is killed, and the test fails; otherwise, since a thread can't be
+/// stopped safely, the process is aborted. Either way the id of the test is printed
+/// with the time it took, and the other tests in progress. Tests that pass but take
+/// over 80% of their timeout yield a warning.
+void SetDefaultTimeout(double milliseconds);
+
+///@brief Which tests to run, based on their outcome in the previous run.
+enum class RerunMode
+{
+  kAll, // in the order of declaration
+  kFailedFirst, // the tests that have previously failed first, then the rest
+  kFailedOnly,  // the tests that have previously failed, then the rest only if they all pass
+};
+
+///@brief Sets which tests to run, based on the outcomes of the previous run, which
+/// are kept in the timing cache (and so require one; see SetTimingCache()).
+/// Combined with SetFailFast(), kFailedFirst stops as soon as a test fails again.
+void SetRerunMode(RerunMode mode);
+
+///@brief Sets the time, in milliseconds, that each benchmark is sampled for after
+/// its iteration count has been calibrated (500ms by default).
+void SetBenchmarkTime(double milliseconds);
+
+///@brief Sets the number of samples that the time of a benchmark is split into
+/// and its statistics are calculated from (10 by default).
+void SetBenchmarkSamples(unsigned int samples);
+
+///@brief Sets the path of a file of benchmark samples from a previous run (see
+/// SetBenchmarkRecord()) to compare benchmarks against. A benchmark fails if its
+/// median time per iteration has regressed by more than the threshold, and a
+/// Mann-Whitney U test finds the difference to be significant. Benchmarks that
+/// are missing from the baseline are not compared.
+void SetBenchmarkBaseline(char const* path);
+
+///@brief Sets the path of a file that the samples of the benchmarks are written
+/// to at the end of RunTests(), for use as a baseline. Records of benchmarks that
+/// haven't run are kept.
+void SetBenchmarkRecord(char const* path);
+
+///@brief Sets the ratio by which the median time per iteration of a benchmark may
+/// exceed its baseline before it's considered a regression (0.05 by default).
+void SetBenchmarkThreshold(double ratio);
+
+///@brief Sets the number of cases that each XM_PROPERTY() is checked with (100 by
+/// default).
+void SetPropertyCases(unsigned int cases);
+
+///@brief Sets the seed that the cases of XM_PROPERTY() tests are generated from.
+/// 0 - the default - picks a seed at random for each RunTests(); either way it's
+/// printed with the failures, so that they can be reproduced.
+void SetPropertySeed(uint64_t seed);
+
+///@brief Sets the number of threads that the cases of an XM_PROPERTY() are checked
+/// on. 0 - the default - uses all cores when the tests are run one at a time (see
+/// SetConcurrency()), and only the thread of the test otherwise.
+void SetPropertyThreads(unsigned int numThreads);
+
+///@brief Processes the command line arguments recognised by eXaM, calling the
+/// respective setter functions. Supported are:
+/// --filter <filterStr>: see SetFilter();
+/// --jobs <n>, -j <n>: see SetConcurrency();
+/// --isolate: see SetIsolation();
+/// --perf-counters: see SetPerfCounters();
+/// --trace <path>: see SetTraceFile();
+/// --shard <index>/<count>: see SetShard();
+/// --shard-summary <path>: see SetShardSummary();
+/// --timing-cache <path>: see SetTimingCache();
+/// --fail-fast: see SetFailFast();
+/// --slowest <n>: see SetSlowestCount();
+/// --list: see SetListOnly();
+/// --repeat <n>: see SetRepeat();
+/// --until-fail: see SetUntilFail();
+/// --shuffle, --shuffle-seed <n>: see SetShuffle();
+/// --timeout <ms>: see SetDefaultTimeout();
+/// --failed-first, --failed-only: see SetRerunMode();
+/// --junit <path>, --jsonl <path>, --tap <path>: see SetReportFile();
+/// --bench-time <ms>: see SetBenchmarkTime();
+/// --bench-samples <n>: see SetBenchmarkSamples();
+/// --bench-baseline <path>: see SetBenchmarkBaseline();
+/// --bench-record <path>: see SetBenchmarkRecord();
+/// --bench-threshold <percent>: see SetBenchmarkThreshold();
+/// --property-cases <n>: see SetPropertyCases();
+/// --seed <n>: see SetPropertySeed();
+/// --property-threads <n>: see SetPropertyThreads().
+///@note Arguments that aren't recognised are ignored.
+void ParseArgs(int argc, char const* const* argv);
+
 ///@brief Runs all test, checking suite and test name against the filters first.
 /// Each test is run until the first failed assertion (if any), at which point the
 /// reason for the failure is printed.
@@ -63,29 +392,192 @@ void SetFilter(char const* filterStr);
 /// from main() directly).
 int RunTests();
 
+///@brief A pseudo-random number generator (SplitMix64), which produces the same
+/// sequence given the same seed, on all platforms.
+class Rng
+{
+public:
+  explicit Rng(uint64_t seed)
+  : mState(seed)
+  {}
+
+  uint64_t Next()
+  {
+    auto z = (mState += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  ///@return A uniformly distributed number in the range [0, @a n), or any number
+  /// if @a n is 0.
+  uint64_t Below(uint64_t n)
+  {
+    if (n == 0)
+    {
+      return Next();
+    }
+
+    auto threshold = (0 - n) % n;  // rejecting the remainder avoids modulo bias.
+    uint64_t r;
+    do
+    {
+      r = Next();
+    }
+    while (r < threshold);
+    return r % n;
+  }
+
+  ///@return A uniformly distributed number in the range [0, 1).
+  double Unit()
+  {
+    return double(Next() >> 11) * 0x1.0p-53;
+  }
+
+private:
+  uint64_t mState;
+};
+
 namespace detail
 {
+class Benchmark;
+}
+
+///@brief The state of an XM_BENCH(), whose body receives it as @e bench. Iterate
+/// over it to run the code being measured for the calibrated number of times, e.g.:
+/// for (auto _ : bench) { xm::DoNotOptimize(Decode(data)); }
+/// Only the loop is timed; setup before and teardown after it is not.
+class Bench
+{
+public:
+  struct [[maybe_unused]] Value {};
+
+  class Iterator
+  {
+  public:
+    Value operator*() const { return Value{}; }
+
+    void operator++() { --mRemaining; }
+
+    bool operator!=(Iterator const&)
+    {
+      if (mRemaining > 0)
+      {
+        return true;
+      }
+
+      mBench->Stop();
+      return false;
+    }
+
+  private:
+    Bench* mBench;
+    uint64_t mRemaining;
+
+    Iterator(Bench* bench, uint64_t remaining): mBench(bench), mRemaining(remaining)
+    {}
+
+    friend class Bench;
+  };
+
+  Iterator begin();
+  Iterator end() { return Iterator{ nullptr, 0 }; }
+
+  ///@brief Sets the number of items that a single iteration processes, for
+  /// reporting the throughput in items per second (iterations per second otherwise).
+  void SetItemsPerIteration(double items) { mItemsPerIteration = items; }
+
+  ///@brief Sets the number of bytes that a single iteration processes, for
+  /// reporting the throughput in bytes per second.
+  void SetBytesPerIteration(double bytes) { mBytesPerIteration = bytes; }
+
+private:
+  uint64_t mIterations = 1;
+  int64_t mStartNs = 0;
+  int64_t mElapsedNs = -1;
+  double mItemsPerIteration = 1.;
+  double mBytesPerIteration = 0.;
+  PerfCounters mStartCounters;
+  PerfCounters mCounters;
+
+  void Stop();
 
-// Provides a facility to format strings into a pre-allocated, thread local buffer
-// without making any further allocations.
-struct StaticStringBuilder
+  friend class detail::Benchmark;
+};
+
+namespace detail
 {
-  StaticStringBuilder();
-  ~StaticStringBuilder();
+void UseCharPointer(char const volatile*);
+}
 
-  std::ostream& Stream() { return mStream; }
+#if defined(XM_COMPILER_MSVC)
+///@brief Forces the compiler to treat @a value as if it was used, preventing the
+/// computation of it from being optimised away.
+template <typename T>
+inline void DoNotOptimize(T const& value)
+{
+  detail::UseCharPointer(&reinterpret_cast<char const volatile&>(value));
+  _ReadWriteBarrier();
+}
 
-  operator char const*() const;
+///@brief Forces the compiler to treat all memory as if it was read and written,
+/// preventing stores from being optimised away or reordered across it.
+inline void ClobberMemory()
+{
+  _ReadWriteBarrier();
+}
+#else
+///@brief Forces the compiler to treat @a value as if it was used, preventing the
+/// computation of it from being optimised away.
+template <typename T>
+inline void DoNotOptimize(T const& value)
+{
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+template <typename T>
+inline void DoNotOptimize(T& value)
+{
+  asm volatile("" : "+m,r"(value) : : "memory");
+}
+
+///@brief Forces the compiler to treat all memory as if it was read and written,
+/// preventing stores from being optimised away or reordered across it.
+inline void ClobberMemory()
+{
+  asm volatile("" : : : "memory");
+}
+#endif
+
+///@brief Prints values of @a T in the messages of failed assertions: specialize it
+/// with a static void Print(T const& value, std::ostream& os). Types that aren't
+/// numbers, strings or pointers, and don't have a ValuePrinter, are printed as bytes.
+/// xm_printers.hpp defines it for all types that have an operator<< for std::ostream.
+///@note The specialization must be visible wherever values of @a T are asserted on.
+template <typename T, typename = void>
+struct ValuePrinter;
+
+namespace detail
+{
+
+// Keeps the allocations made on this thread from counting towards those of the
+// current test, for the lifetime of the object (see AllocationStats).
+class AllocationPause
+{
+public:
+  AllocationPause();
+  ~AllocationPause();
 
 private:
-  std::ostream mStream;
+  bool mWasPaused;
 
-  StaticStringBuilder(StaticStringBuilder const&) = delete;
-  StaticStringBuilder& operator=(StaticStringBuilder const&) = delete;
-  StaticStringBuilder(StaticStringBuilder&&) = delete;
-  StaticStringBuilder& operator=(StaticStringBuilder&&) = delete;
+  AllocationPause(AllocationPause const&) = delete;
+  AllocationPause& operator=(AllocationPause const&) = delete;
 };
 
+// The number of assertions made on this thread, since the start of the current test.
+inline thread_local size_t sAssertionCount = 0;
+
 // Big enough integer type to wrap integers and enums for printing.
 using IntWrap = long long;
 
@@ -112,263 +604,597 @@ struct StringWrap
   bool operator==(StringWrap const& other) const
   {
     return !!mString == !!other.mString &&
-      strncmp(mString, other.mString, std::max(mSize, other.mSize)) == 0;
+      strncmp(mString, other.mString, mSize > other.mSize ? mSize : other.mSize) == 0;
   }
 
   char const* const mString;
   size_t const mSize;
 };
 
-std::ostream& operator<<(std::ostream& os, StringWrap const& sw);
-
-// Printer categories for funneling values.
-enum Category
+// A value to print in a failure message, reduced to one of the kinds that xm.cpp
+// knows how to print - or, for types with a ValuePrinter, to a pointer to it and
+// a function that prints it -, so that the messages are formatted out of line, and
+// assertions only instantiate this much per type.
+struct Printable
 {
-  kNumeric,
-  kString,
-  kFunction,
-  kOther,
-};
-
-template <Category k> // kOther is default. Prints objects as a byte buffer, up to 64 bytes.
-struct Printer
-{
-  enum { kMaxBytesPrinted = 64u };
-
-  template <typename T>
-  static void Print(T const& value, std::ostream& os)
+  enum Kind : uint8_t
+  {
+    kInteger,
+    kFloat,
+    kDouble,
+    kBool,
+    kString,
+    kPointer,
+    kNullptr,
+    kBytes, // of an object that doesn't have a ValuePrinter; see PrintBytes().
+    kCustom,
+  };
+
+  using PrintFn = void(*)(void const* value, std::ostream& os);
+
+  Kind kind;
+  union
   {
-    auto i0 = reinterpret_cast<uint8_t const*>(&value);
-    auto i1 = i0 + std::min(sizeof(T), size_t(kMaxBytesPrinted));
-    char buffer[4];
-    while (i0 != i1)
+    IntWrap integer;
+    float f;
+    double d;
+    bool b;
+    void const* pointer;
+    struct
     {
-      snprintf(buffer, sizeof(buffer), "%02x ", *i0);
-      os << buffer;
-      ++i0;
-    }
-
-    if constexpr (sizeof(T) > kMaxBytesPrinted)
+      void const* data;
+      size_t size;
+    } bytes; // or a string
+    struct
     {
-      os << "...";
-    }
-  }
+      void const* value;
+      PrintFn print;
+    } custom;
+  };
 };
 
-template <>
-struct Printer<kFunction>
+template <typename T, typename = void>
+struct HasValuePrinter : std::false_type {};
+
+template <typename T>
+struct HasValuePrinter<T, std::void_t<decltype(sizeof(ValuePrinter<T>))>> : std::true_type {};
+
+template <typename T>
+void PrintCustom(void const* value, std::ostream& os)
+{
+  ValuePrinter<T>::Print(*static_cast<T const*>(value), os);
+}
+
+// Makes the Printable of @a value, as compared to a value of type U, e.g. char* is
+// only printed as a string if the other value is string wrappable (otherwise it may
+// be a pointer to the end of a range / buffer, so it shouldn't be dereferenced).
+template <typename T, typename U>
+Printable MakePrintable(T const& value)
 {
-  template <typename T>
-  static void Print(T value, std::ostream& os)
+  Printable p;
+  if constexpr (std::is_null_pointer_v<T>)
   {
-    os << reinterpret_cast<void const*>(&value);
+    p.kind = Printable::kNullptr;
   }
-};
-
-template <>
-struct Printer<kString> // Prints wrappable strings.
-{
-  static void Print(StringWrap const& value, std::ostream& os)
+  else if constexpr (std::is_pointer_v<T> && (std::is_pointer_v<U> || std::is_null_pointer_v<U>) &&
+    !std::is_function_v<std::remove_pointer_t<T>>)
   {
-    os << "\"" << value << "\"";
+    p.kind = value ? Printable::kPointer : Printable::kNullptr;
+    p.pointer = value;
   }
-};
-
-template <>
-struct Printer<kNumeric>  // Prints numeric types, including enums (on a best effort basis) and bools.
-{
-  template <typename T>
-  static void Print(T const& value, std::ostream& os)
+  else if constexpr (std::is_convertible_v<T, StringWrap>)
   {
-    os << static_cast<IntWrap>(value);
+    StringWrap str(value);
+    p.kind = Printable::kString;
+    p.bytes = { str.mString, str.mSize };
   }
-
-  static void Print(float value, std::ostream& os)
+  else if constexpr (std::is_same_v<T, bool>)
   {
-    os << value << "f";
+    p.kind = Printable::kBool;
+    p.b = value;
   }
-
-  static void Print(double value, std::ostream& os)
+  else if constexpr (std::is_same_v<T, float>)
   {
-    os << value;
+    p.kind = Printable::kFloat;
+    p.f = value;
   }
-
-  static void Print(bool value, std::ostream& os)
+  else if constexpr (std::is_floating_point_v<T>)
   {
-    os << (value ? "true" : "false");
+    p.kind = Printable::kDouble;
+    p.d = double(value);
   }
-};
-
-// Responsible for dispatching print calls based on the types of the values being
-// compared. E.g. char* will only be printed as a string if the other value is
-// string wrappable (otherwise it may be a pointer to the end of a range / buffer,
-// so we shouldn't be dereferencing it).
-template <typename T1, typename T2, typename Enable = void>
-struct PrintDispatcher
-{
-XM_WARNINGS_PUSH
-XM_MSVC_WARNING(disable: 4180)  // MSVC considers const-qualifying function pointer types redundant.
-
-  static void Dispatch(T1 const& value, std::ostream& os)
+  else if constexpr (std::is_enum_v<T> || std::is_convertible_v<T, IntWrap>)
   {
-XM_WARNINGS_POP
-
-    Printer<std::is_convertible_v<T1, StringWrap> ? kString :
-      (std::is_enum_v<T1> || std::is_convertible_v<T1, IntWrap>) ? kNumeric :
-      std::is_function_v<T1> ? kFunction :
-      kOther>::Print(value, os);
+    p.kind = Printable::kInteger;
+    p.integer = static_cast<IntWrap>(value);
   }
-};
-
-template <typename T1, typename T2>
-struct PrintDispatcher<T1*, T2*, std::enable_if_t<!std::is_function_v<T1>>>
-{
-  static void Dispatch(T1 const* value, std::ostream& os)
+  else if constexpr (std::is_function_v<T>)
   {
-    if (value)
-    {
-      os << static_cast<void const*>(value);
-    }
-    else
-    {
-      os << "nullptr";
-    }
+    p.kind = Printable::kPointer;
+    p.pointer = reinterpret_cast<void const*>(&value);
   }
-};
-
-template <typename T1>
-struct PrintDispatcher<T1*, nullptr_t, std::enable_if_t<!std::is_function_v<T1>>>
-{
-  static void Dispatch(T1 const* value, std::ostream& os)
+  else if constexpr (HasValuePrinter<T>::value)
   {
-    if (value)
-    {
-      os << static_cast<void const*>(value);
-    }
-    else
-    {
-      os << "nullptr";
-    }
+    p.kind = Printable::kCustom;
+    p.custom = { &value, PrintCustom<T> };
   }
-};
-
-template <typename T2>
-struct PrintDispatcher<nullptr_t, T2>
-{
-  static void Dispatch(nullptr_t, std::ostream& os)
+  else
   {
-    os << "nullptr";
+    p.kind = Printable::kBytes;
+    p.bytes = { &value, sizeof(T) };
   }
+  return p;
+}
+
+// Prints @a value to @a os, as failure messages show it.
+void Print(Printable const& value, std::ostream& os);
+
+// A range whose elements are printed in failure messages, by their index.
+struct PrintableRange
+{
+  using PrintAtFn = void(*)(void const* range, size_t index, std::ostream& os);
+
+  void const* range;
+  size_t size;
+  PrintAtFn printAt;
 };
 
+template <typename T, typename U>
+void PrintElementAt(void const* range, size_t index, std::ostream& os)
+{
+  using A = std::decay_t<decltype(*std::begin(std::declval<T const&>()))>;
+  using B = std::decay_t<decltype(*std::begin(std::declval<U const&>()))>;
+  auto i = std::begin(*static_cast<T const*>(range));
+  std::advance(i, index);
+  Print(MakePrintable<A, B>(*i), os);
+}
+
 struct Formatter  // Formats the messages displayed for failed assertions.
 {
   template <typename T1, typename T2>
-  static void FormatExpression(char const* expr, T1 const& value, std::ostream& os)
+  static char const* Format(char const* aStr, T1 const& a, char const* opStr, char const* bStr, T2 const& b)
   {
-    os << expr;
-
-    std::ostringstream ss;
-    PrintDispatcher<T1, T2>::Dispatch(value, ss);
-    if (ss.str().compare(expr) != 0)
-    {
-      os << " (which is " << ss.str() << ")";
-    }
+    return FormatComparison(aStr, MakePrintable<T1, T2>(a), opStr, bStr, MakePrintable<T2, T1>(b));
   }
 
-  template <typename T1, typename T2>
-  static char const* Format(char const* aStr, T1 const& a, char const* opStr, char const* bStr, T2 const& b)
-  {
-    StaticStringBuilder ssb;
-    auto& stream = ssb.Stream();
-    stream << "Expected: ";
-    FormatExpression<T1, T2>(aStr, a, stream);
-    stream << " " << opStr << " ";
-    FormatExpression<T2, T1>(bStr, b, stream);
+  static char const* FormatComparison(char const* aStr, Printable const& a, char const* opStr,
+    char const* bStr, Printable const& b);
+
+  static char const* Format(char const* str);
 
-    return ssb;
+  // Formats the mismatch of ranges @a a and @a b, at @a index, showing the elements
+  // around it.
+  template <typename T, typename U>
+  static char const* FormatRangeMismatch(char const* aStr, T const& a, size_t aSize,
+    char const* bStr, U const& b, size_t bSize, size_t index)
+  {
+    return FormatRangeMismatch(aStr, PrintableRange{ &a, aSize, PrintElementAt<T, U> },
+      bStr, PrintableRange{ &b, bSize, PrintElementAt<U, T> }, index);
   }
 
-  static char const* Format(char const* str);
+  static char const* FormatRangeMismatch(char const* aStr, PrintableRange const& a,
+    char const* bStr, PrintableRange const& b, size_t index);
+
+  // Formats the mismatch of the @a size bytes at @a a and @a b, at @a offset, as a
+  // hex dump of the rows of bytes around it.
+  static char const* FormatMemMismatch(char const* aStr, uint8_t const* a, char const* bStr,
+    uint8_t const* b, size_t size, size_t offset);
 
 private:
   Formatter() = delete;
 };
 
+///@return The offset of the first byte that differs between @a a and @a b, or
+/// @a size if none do.
+size_t FindMismatch(void const* a, void const* b, size_t size);
+
+// The absolute value of @a value, for XM_ASSERT_FEQ(), without a dependency on <cmath>.
+template <typename T>
+constexpr T Abs(T value)
+{
+  return value < T(0) ? -value : value;
+}
+
+template <typename T, typename = void>
+struct IsContiguous : std::false_type {};
+
+template <typename T>
+struct IsContiguous<T, std::void_t<decltype(std::data(std::declval<T const&>()))>> : std::true_type {};
+
 // Throws the type of exception that the test framework recognises as a failure,
-// with the given message.
+// with the given message. With XM_NO_EXCEPTIONS, records the failure and returns,
+// leaving it to the XM_ASSERT_*() macros to return from the test.
 void Fail(char const* message);
 
-struct Assert // Performs checks and throws exceptions for RunTests() to catch.
+// Records the failure of an expectation, with the given message, and returns; the
+// test fails once it has finished.
+void RecordFailure(char const* message);
+
+using FailFn = void(*)(char const* message);
+
+// Performs checks and throws exceptions for RunTests() to catch - or, given
+// RecordFailure() for @a fail, records them. The failure messages are only formatted
+// once the check has failed. Returns whether the check has passed.
+struct Assert
 {
-  static void True(bool value, char const* str);
+  static bool True(bool value, char const* str, FailFn fail = Fail);
 
   template <typename T, typename U>
-  static void Equal(T const& a, U const& b, char const* aStr, char const* bStr)
+  static bool Equal(T const& a, U const& b, char const* aStr, char const* bStr, FailFn fail = Fail)
   {
-    Check(a == b, Formatter::Format(aStr, a, "==", bStr, b));
+    ++sAssertionCount;
+    if (!(a == b))
+    {
+      fail(Formatter::Format(aStr, a, "==", bStr, b));
+      return false;
+    }
+    return true;
   }
 
   template <typename T, typename U>
-  static void LessThan(T const& a, U const& b, char const* aStr, char const* bStr)
+  static bool LessThan(T const& a, U const& b, char const* aStr, char const* bStr, FailFn fail = Fail)
   {
-    Check(a < b, Formatter::Format(aStr, a, "<", bStr, b));
+    ++sAssertionCount;
+    if (!(a < b))
+    {
+      fail(Formatter::Format(aStr, a, "<", bStr, b));
+      return false;
+    }
+    return true;
   }
 
   template <typename T, typename U>
-  static void LessEqual(T const& a, U const& b, char const* aStr, char const* bStr)
+  static bool LessEqual(T const& a, U const& b, char const* aStr, char const* bStr, FailFn fail = Fail)
   {
-    Check(a <= b, Formatter::Format(aStr, a, "<=", bStr, b));
+    ++sAssertionCount;
+    if (!(a <= b))
+    {
+      fail(Formatter::Format(aStr, a, "<=", bStr, b));
+      return false;
+    }
+    return true;
   }
 
   template <typename T, typename U>
-  static void GreaterThan(T const& a, U const& b, char const* aStr, char const* bStr)
+  static bool GreaterThan(T const& a, U const& b, char const* aStr, char const* bStr, FailFn fail = Fail)
   {
-    Check(a > b, Formatter::Format(aStr, a, ">", bStr, b));
+    ++sAssertionCount;
+    if (!(a > b))
+    {
+      fail(Formatter::Format(aStr, a, ">", bStr, b));
+      return false;
+    }
+    return true;
   }
 
   template <typename T, typename U>
-  static void GreaterEqual(T const& a, U const& b, char const* aStr, char const* bStr)
+  static bool GreaterEqual(T const& a, U const& b, char const* aStr, char const* bStr, FailFn fail = Fail)
   {
-    Check(a >= b, Formatter::Format(aStr, a, ">=", bStr, b));
+    ++sAssertionCount;
+    if (!(a >= b))
+    {
+      fail(Formatter::Format(aStr, a, ">=", bStr, b));
+      return false;
+    }
+    return true;
   }
 
   template <typename T, typename U>
-  static void NotEqual(T const& a, U const& b, char const* aStr, char const* bStr)
+  static bool NotEqual(T const& a, U const& b, char const* aStr, char const* bStr, FailFn fail = Fail)
   {
-    Check(a != b, Formatter::Format(aStr, a, "!=", bStr, b));
+    ++sAssertionCount;
+    if (!(a != b))
+    {
+      fail(Formatter::Format(aStr, a, "!=", bStr, b));
+      return false;
+    }
+    return true;
+  }
+
+  // Compares the elements of ranges; with contiguous storage of the same type of
+  // elements, which are equal exactly if their bytes are, using FindMismatch().
+  template <typename T, typename U>
+  static bool RangeEqual(T const& a, U const& b, char const* aStr, char const* bStr, FailFn fail = Fail)
+  {
+    using A = std::decay_t<decltype(*std::begin(a))>;
+    using B = std::decay_t<decltype(*std::begin(b))>;
+
+    ++sAssertionCount;
+    auto aSize = size_t(std::distance(std::begin(a), std::end(a)));
+    auto bSize = size_t(std::distance(std::begin(b), std::end(b)));
+    auto size = aSize < bSize ? aSize : bSize;
+    size_t index;
+    if constexpr (IsContiguous<T>::value && IsContiguous<U>::value && std::is_same_v<A, B> &&
+      std::has_unique_object_representations_v<A>)
+    {
+      index = size > 0 ? FindMismatch(std::data(a), std::data(b), size * sizeof(A)) / sizeof(A) : 0;
+    }
+    else
+    {
+      auto iA = std::begin(a);
+      auto iB = std::begin(b);
+      index = 0;
+      while (index < size && *iA == *iB)
+      {
+        ++iA;
+        ++iB;
+        ++index;
+      }
+    }
+
+    if (index < size || aSize != bSize)
+    {
+      fail(Formatter::FormatRangeMismatch(aStr, a, aSize, bStr, b, bSize, index));
+      return false;
+    }
+    return true;
   }
 
-  static void Check(bool value, char const* message);
+  // Compares @a size bytes of memory at @a a and @a b.
+  static bool MemEqual(void const* a, void const* b, size_t size, char const* aStr,
+    char const* bStr, FailFn fail = Fail);
+
+  ///@note @a message is evaluated regardless of @a value; prefer branching and
+  /// calling Fail() where formatting it is not free.
+  static bool Check(bool value, char const* message);
+
+  // Fails if the current test has made more than @a max allocations so far, or if
+  // allocations are not tracked.
+  static bool MaxAllocations(size_t max, char const* maxStr);
 
 private:
   Assert() = delete;
 };
 
-class Test  // Test base class. Derive from & instantiate using the XM_TEST() and XM_TEST_F() macros.
+// Fails if any allocations were made between its construction and the second call
+// to Next(), i.e. in the body of the for loop that XM_ASSERT_NO_ALLOCS expands to.
+class NoAllocationsScope
+{
+public:
+  NoAllocationsScope();
+
+  bool Next();
+
+private:
+  size_t mStartCount;
+  bool mEntered = false;
+};
+
+// Traces a slice of the test on this thread - nested in the slice of the test -, from
+// its construction to the call to Next(), which starts the next slice, and so on, until
+// its destruction, when tracing is enabled (see SetTraceFile()).
+class TraceSlice
+{
+public:
+  explicit TraceSlice(char const* name);
+  ~TraceSlice();
+
+  void Next(char const* name);
+
+  TraceSlice(TraceSlice const&) = delete;
+  TraceSlice& operator=(TraceSlice const&) = delete;
+
+private:
+  char const* mName;
+  int64_t mBeginNs;
+};
+
+class SuiteFixtureBase;
+
+class Test  // Test base class. Derive from & register using the XM_TEST() and XM_TEST_F() macros.
 {
 protected:
-  Test(char const* suite, char const* name);
+  Test(char const* suite, char const* name, bool isBenchmark = false);
+  Test(char const* suite, char const* name, SuiteFixtureBase& suiteFixture);
   virtual ~Test();
 
   bool Run();
 
   virtual void RunInternal() =0;
 
+  ///@return The number of tests that this one stands for; just itself by default.
+  virtual size_t GetNumInstances() { return 1; }
+
+  virtual Test& GetInstance(size_t /*i*/) { return *this; }
+
 private:
   char const* mSuite;
   char const* mName;
-  Test* mNext = nullptr;
+  bool mIsBenchmark;
+  SuiteFixtureBase* mSuiteFixture = nullptr;
+  double mTimeout = .0; // milliseconds, as resolved for the current RunTests().
+
+  friend struct Runner;
+};
+
+// Describes a registered test: its id, and the function that creates it (on the first
+// call), which RunTests() only calls for the tests that pass the filters, and groups
+// (see TestGroup), whose ids aren't known until they're created. The descriptors are
+// constant initialized, and pointers to them placed in the xm_tests section where
+// it's supported (see XM_DETAIL_REGISTER()), so registering a test takes no work
+// before main().
+struct TestDescriptor
+{
+  char const* suite;
+  char const* name;
+  Test& (*create)();
+  bool isGroup;
+  char const* file;  // the location of the test; the order of declaration is
+  int line;          // restored from these, as the linker may not keep it.
+};
+
+// Links the descriptor of a test into a list, where a section isn't supported.
+struct Registration
+{
+  explicit Registration(TestDescriptor const& descriptor);
+
+  TestDescriptor const& mDescriptor;
+  Registration* mNext = nullptr;
+};
+
+// Registers the timeout of a test by its suite and name; see XM_TIMEOUT().
+struct Timeout
+{
+  Timeout(char const* suite, char const* name, double milliseconds);
+
+  char const* const mSuite;
+  char const* const mName;
+  double const mMilliseconds;
+  Timeout* const mNext;
+};
+
+// Keeps the instance of a fixture that the XM_TEST_SF() tests of a suite share.
+// It's created by the first of them to run, and destroyed once all the ones that
+// RunTests() has selected have run.
+class SuiteFixtureBase
+{
+protected:
+  SuiteFixtureBase();
+  virtual ~SuiteFixtureBase();
+
+  virtual void Destroy() =0;
+
+private:
+  size_t mNumRemaining = 0; // selected tests yet to run in the current RunTests().
+  SuiteFixtureBase* mNext = nullptr;
+
+  friend struct Runner;
+};
+
+template <class T>
+class SuiteFixture : public SuiteFixtureBase
+{
+public:
+  static SuiteFixture& Instance()
+  {
+    static SuiteFixture sInstance;
+    return sInstance;
+  }
+
+  T& Get()
+  {
+    if (!mFixture)
+    {
+      TraceSlice slice("suite setup");
+      AllocationPause pause;
+      mFixture = new T;
+    }
+    return *mFixture;
+  }
 
-  friend int xm::RunTests();
+protected:
+  void Destroy() override
+  {
+    delete mFixture;
+    mFixture = nullptr;
+  }
+
+private:
+  T* mFixture = nullptr;
+
+  SuiteFixture() = default;
+
+  ~SuiteFixture()
+  {
+    Destroy();
+  }
+};
+
+template <typename T, typename = void>
+struct HasReset : std::false_type {};
+
+template <typename T>
+struct HasReset<T, std::void_t<decltype(std::declval<T&>().Reset())>> : std::true_type {};
+
+// The fixture of an XM_TEST_F(), constructed for the test and destroyed after it.
+template <class T, bool = HasReset<T>::value>
+class Fixture
+{
+private:
+  [[maybe_unused]] T mFixture;
+};
+
+// The fixture of an XM_TEST_F() that has a Reset() member: each thread keeps an
+// instance, which is constructed for the first of its tests - its allocations not
+// counted, as it outlives the test -, and reset before each of the rest.
+template <class T>
+class Fixture<T, true>
+{
+public:
+  Fixture()
+  {
+    thread_local Pooled sPooled;
+    if (sPooled.fixture)
+    {
+      sPooled.fixture->Reset();
+    }
+    else
+    {
+      AllocationPause pause;
+      sPooled.fixture = new T;
+    }
+  }
+
+private:
+  struct Pooled
+  {
+    T* fixture = nullptr;
+
+    ~Pooled() { delete fixture; }
+  };
+};
+
+class Benchmark : protected Test  // Benchmark base class. Derive from & instantiate using the XM_BENCH() macro.
+{
+protected:
+  Benchmark(char const* suite, char const* name);
+
+  // Calibrates the number of iterations, then samples RunBench() with it.
+  void RunInternal() override;
+
+  virtual void RunBench(Bench& bench) =0;
 };
 
 } // detail
+
 } // xm
 
 #define XM_DETAIL_TEST_NAME(suite, name) suite ## _ ## name
 #define XM_DETAIL_TEST_CLASS_NAME(suite, name) XM_DETAIL_TEST_NAME(suite, name ## TestType)
 
+// Registers the test @a suite, @a name, which @a create returns; see TestDescriptor.
+// The section is only used where its entries can be retained: 'used' keeps them from
+// the compiler, but not from the linker's --gc-sections.
+#if defined(__has_attribute)
+#if __has_attribute(retain)
+#define XM_DETAIL_HAS_RETAIN
+#endif
+#endif
+
+#if defined(__ELF__) && (defined(__GNUC__) || defined(__clang__)) && defined(XM_DETAIL_HAS_RETAIN)
+#define XM_DETAIL_USE_SECTION
+#define XM_DETAIL_REGISTER(suite, name, create, isGroup)\
+  static xm::detail::TestDescriptor const XM_DETAIL_TEST_NAME(suite, name ## Descriptor){\
+    #suite, #name, create, isGroup, __FILE__, __LINE__ };\
+  __attribute__((used, retain, section("xm_tests"))) static xm::detail::TestDescriptor const* const\
+    XM_DETAIL_TEST_NAME(suite, name ## Registration) = &XM_DETAIL_TEST_NAME(suite, name ## Descriptor)
+#else
+#define XM_DETAIL_REGISTER(suite, name, create, isGroup)\
+  static xm::detail::TestDescriptor const XM_DETAIL_TEST_NAME(suite, name ## Descriptor){\
+    #suite, #name, create, isGroup, __FILE__, __LINE__ };\
+  static xm::detail::Registration XM_DETAIL_TEST_NAME(suite, name ## Registration)(\
+    XM_DETAIL_TEST_NAME(suite, name ## Descriptor))
+#endif
+
+// Defines the function that creates the test of the enclosing class, @a type, from
+// the parenthesized constructor @a args, or {}.
+#define XM_DETAIL_CREATE(type, args)\
+  static xm::detail::Test& Create()\
+  {\
+    static type sTest args;\
+    return sTest;\
+  }
+
 ///@brief Use this to declare and define a simple test case. e.g.:<br/>
 /// XM_TEST(Io, Serialization) {<br/>
 ///   // test body here.<br/>
@@ -377,9 +1203,11 @@ private:
   {\
   public:\
     XM_DETAIL_TEST_CLASS_NAME(suite, name) () : xm::detail::Test(#suite, #name) {}\
+    XM_DETAIL_CREATE(XM_DETAIL_TEST_CLASS_NAME(suite, name), {})\
   protected:\
     void RunInternal() override;\
-  } XM_DETAIL_TEST_NAME(suite, name ## Test);\
+  };\
+  XM_DETAIL_REGISTER(suite, name, XM_DETAIL_TEST_CLASS_NAME(suite, name)::Create, false);\
   void XM_DETAIL_TEST_CLASS_NAME(suite, name) ::RunInternal()
 
 ///@brief Use this to declare and define a test case using a default constructible
@@ -393,57 +1221,202 @@ private:
 /// XM_TEST_F(Io, Serialization) {<br/>
 ///   // test body here.<br/>
 /// }<br/>
+/// Should the fixture have a Reset() member, each worker thread keeps an instance
+/// of it instead, which is constructed for its first test, and reset before the rest.
 #define XM_TEST_F(fixture, name) class XM_DETAIL_TEST_CLASS_NAME(fixture, name) : protected xm::detail::Test\
   {\
   public:\
     XM_DETAIL_TEST_CLASS_NAME(fixture, name) () : xm::detail::Test(#fixture, #name) {}\
+    XM_DETAIL_CREATE(XM_DETAIL_TEST_CLASS_NAME(fixture, name), {})\
     void RunInternal() override {\
-      fixture f;\
+      xm::detail::TraceSlice slice("setup");\
+      xm::detail::Fixture<fixture> f;\
+      slice.Next("body");\
       RunItAlready();\
+      slice.Next("teardown");\
     };\
   protected:\
     void RunItAlready();\
-  } XM_DETAIL_TEST_NAME(fixture, name ## Test);\
+  };\
+  XM_DETAIL_REGISTER(fixture, name, XM_DETAIL_TEST_CLASS_NAME(fixture, name)::Create, false);\
   void XM_DETAIL_TEST_CLASS_NAME(fixture, name) ::RunItAlready()
 
+///@brief Use this to declare and define a test case using a default constructible
+/// fixture class, a single instance of which is shared by all tests of the suite,
+/// and is accessible as @e f. It's created before the first test of the suite that
+/// was selected to run, and destroyed after the last one. e.g.:<br/>
+/// struct Dataset // fixture<br/>
+/// {<br/>
+///   Dataset() { Load("huge.bin"); }<br/>
+/// };<br/>
+/// XM_TEST_SF(Dataset, Query) {<br/>
+///   XM_ASSERT_TRUE(f.Contains(42));<br/>
+/// }<br/>
+///@note The tests of the suite are run one after the other on the same worker thread
+/// (see SetConcurrency()), so the fixture isn't accessed concurrently; they must not
+/// depend on the order they run in, however, or leave the fixture in a state that
+/// affects the others.
+#define XM_TEST_SF(fixture, name) class XM_DETAIL_TEST_CLASS_NAME(fixture, name) : protected xm::detail::Test\
+  {\
+  public:\
+    XM_DETAIL_TEST_CLASS_NAME(fixture, name) () : xm::detail::Test(#fixture, #name,\
+      xm::detail::SuiteFixture<fixture>::Instance()) {}\
+    XM_DETAIL_CREATE(XM_DETAIL_TEST_CLASS_NAME(fixture, name), {})\
+    void RunInternal() override {\
+      RunItAlready(xm::detail::SuiteFixture<fixture>::Instance().Get());\
+    };\
+  protected:\
+    void RunItAlready([[maybe_unused]] fixture& f);\
+  };\
+  XM_DETAIL_REGISTER(fixture, name, XM_DETAIL_TEST_CLASS_NAME(fixture, name)::Create, false);\
+  void XM_DETAIL_TEST_CLASS_NAME(fixture, name) ::RunItAlready([[maybe_unused]] fixture& f)
+
+///@brief Use this to give the test @a suite, @a name a timeout of @a milliseconds,
+/// overriding the default (see SetDefaultTimeout()); 0 means no timeout. e.g.:<br/>
+/// XM_TEST(Net, Connect) {<br/>
+///   ...<br/>
+/// }<br/>
+/// XM_TIMEOUT(Net, Connect, 10000);
+#define XM_TIMEOUT(suite, name, milliseconds) static xm::detail::Timeout\
+  XM_DETAIL_TEST_NAME(suite, name ## Timeout)(#suite, #name, (milliseconds))
+
+///@brief Use this to declare and define a benchmark, which is registered among,
+/// filtered and reported along with the tests, e.g.:<br/>
+/// XM_BENCH(Io, Decode) {<br/>
+///   auto data = LoadData(); // not measured<br/>
+///   for (auto _ : bench) {<br/>
+///     xm::DoNotOptimize(Decode(data));<br/>
+///   }<br/>
+/// }<br/>
+/// The body is run repeatedly while the number of iterations is calibrated to take
+/// up a sample's worth of SetBenchmarkTime(), then once for each sample. Benchmarks
+/// are never run concurrently with other tests.
+#define XM_BENCH(suite, name) class XM_DETAIL_TEST_CLASS_NAME(suite, name) : protected xm::detail::Benchmark\
+  {\
+  public:\
+    XM_DETAIL_TEST_CLASS_NAME(suite, name) () : xm::detail::Benchmark(#suite, #name) {}\
+    XM_DETAIL_CREATE(XM_DETAIL_TEST_CLASS_NAME(suite, name), {})\
+  protected:\
+    void RunBench(xm::Bench& bench) override;\
+  };\
+  XM_DETAIL_REGISTER(suite, name, XM_DETAIL_TEST_CLASS_NAME(suite, name)::Create, false);\
+  void XM_DETAIL_TEST_CLASS_NAME(suite, name) ::RunBench(xm::Bench& bench)
+
 ///@brief Fails a test with the given @a message.
 ///@note The message is printed as is, with no further formatting.
+#if defined XM_NO_EXCEPTIONS
+#define XM_FAIL(message) do { xm::detail::Fail(message); return; } while (false)
+#else
 #define XM_FAIL(message) xm::detail::Fail(message)
+#endif
+
+// Makes the failure of an assertion end the test - with XM_NO_EXCEPTIONS, by
+// returning, so that assertions may only be used in functions that return void.
+#if defined XM_NO_EXCEPTIONS
+#define XM_DETAIL_ASSERT(check) do { if (!(check)) { return; } } while (false)
+#else
+#define XM_DETAIL_ASSERT(check) (check)
+#endif
 
 ///@brief Asserts @a expr to be true.
 ///@note Prefer to use XM_ASSERT_STREQ() for equality of strings, which eliminates
 /// the rist of (char) pointers being compared arithmetically, rather than their
 /// pointed-to data, lexically.
-#define XM_ASSERT_TRUE(expr) xm::detail::Assert::True((expr), #expr)
+#define XM_ASSERT_TRUE(expr) XM_DETAIL_ASSERT(xm::detail::Assert::True((expr), #expr))
 
 ///@brief Asserts @a expr to be false.
-#define XM_ASSERT_FALSE(expr) xm::detail::Assert::True(!(expr), "!(" #expr ")")
+#define XM_ASSERT_FALSE(expr) XM_DETAIL_ASSERT(xm::detail::Assert::True(!(expr), "!(" #expr ")"))
 
 ///@brief Asserts @a a and @a b to be equal.
-#define XM_ASSERT_EQ(a, b) xm::detail::Assert::Equal((a), (b), #a, #b)
+#define XM_ASSERT_EQ(a, b) XM_DETAIL_ASSERT(xm::detail::Assert::Equal((a), (b), #a, #b))
 
 ///@brief Asserts @a a to be less than @a b.
-#define XM_ASSERT_LT(a, b) xm::detail::Assert::LessThan((a), (b), #a, #b)
+#define XM_ASSERT_LT(a, b) XM_DETAIL_ASSERT(xm::detail::Assert::LessThan((a), (b), #a, #b))
 
 ///@brief Asserts @a a to be less than or equal to @a b.
-#define XM_ASSERT_LE(a, b) xm::detail::Assert::LessEqual((a), (b), #a, #b)
+#define XM_ASSERT_LE(a, b) XM_DETAIL_ASSERT(xm::detail::Assert::LessEqual((a), (b), #a, #b))
 
 ///@brief Asserts @a a to be greater than @a b.
-#define XM_ASSERT_GT(a, b) xm::detail::Assert::GreaterThan((a), (b), #a, #b)
+#define XM_ASSERT_GT(a, b) XM_DETAIL_ASSERT(xm::detail::Assert::GreaterThan((a), (b), #a, #b))
 
 ///@brief Asserts @a a to be greater than or equal to @a b.
-#define XM_ASSERT_GE(a, b) xm::detail::Assert::GreaterEqual((a), (b), #a, #b)
+#define XM_ASSERT_GE(a, b) XM_DETAIL_ASSERT(xm::detail::Assert::GreaterEqual((a), (b), #a, #b))
 
 ///@brief Asserts @a and @a b to not be equal.
-#define XM_ASSERT_NE(a, b) xm::detail::Assert::NotEqual((a), (b), #a, #b)
+#define XM_ASSERT_NE(a, b) XM_DETAIL_ASSERT(xm::detail::Assert::NotEqual((a), (b), #a, #b))
 
 ///@brief Asserts equality of floating point values @a a and @a b
-#define XM_ASSERT_FEQ(a, b, epsilon) XM_ASSERT_LT(std::abs((a) - (b)), epsilon)
+#define XM_ASSERT_FEQ(a, b, epsilon) XM_ASSERT_LT(xm::detail::Abs((a) - (b)), epsilon)
 
 ///@brief Asserts @a and @a b, explicitly handled as strings, to be equal.
-#define XM_ASSERT_STREQ(a, b) xm::detail::Assert::Equal(xm::detail::StringWrap(a), xm::detail::StringWrap(b), #a, #b)
+#define XM_ASSERT_STREQ(a, b) XM_DETAIL_ASSERT(xm::detail::Assert::Equal(xm::detail::StringWrap(a), xm::detail::StringWrap(b), #a, #b))
+
+///@brief Asserts ranges @a a and @a b - containers, arrays, or anything else that
+/// std::begin() and std::end() work with - to be of the same size, and their elements
+/// to be equal. Contiguous ranges of the same type of element are compared with
+/// memcmp(), where that's equivalent. Reports the first mismatch, showing the elements
+/// around it.
+#define XM_ASSERT_RANGE_EQ(a, b) XM_DETAIL_ASSERT(xm::detail::Assert::RangeEqual((a), (b), #a, #b))
+
+///@brief Asserts the @a size bytes of memory at @a a and @a b to be equal. Reports
+/// the first mismatch, as a hex dump of the bytes around it.
+#define XM_ASSERT_MEM_EQ(a, b, size) XM_DETAIL_ASSERT(xm::detail::Assert::MemEqual((a), (b), (size), #a, #b))
+
+///@brief Asserts that the current test has made at most @a n heap allocations so far.
+///@note Requires xm.cpp to be compiled with XM_TRACK_ALLOCATIONS defined; fails otherwise.
+#define XM_ASSERT_MAX_ALLOCS(n) XM_DETAIL_ASSERT(xm::detail::Assert::MaxAllocations((n), #n))
+
+///@brief Asserts that no heap allocations are made in the following statement or
+/// block, e.g.:<br/>
+/// XM_ASSERT_NO_ALLOCS {<br/>
+///   hotPath.Process(input);<br/>
+/// }<br/>
+///@note Requires xm.cpp to be compiled with XM_TRACK_ALLOCATIONS defined; fails
+/// otherwise. Leaving the block with break or return skips the check.
+#define XM_ASSERT_NO_ALLOCS for (xm::detail::NoAllocationsScope xmNoAllocs; xmNoAllocs.Next(); )
+
+///@brief The XM_EXPECT_*() macros perform the same checks as their XM_ASSERT_*()
+/// counterparts, but a failed expectation doesn't end the test: it's recorded and
+/// the test carries on, to fail once it has finished, reporting the messages of all
+/// failed expectations together.
+#define XM_EXPECT_TRUE(expr) xm::detail::Assert::True((expr), #expr, xm::detail::RecordFailure)
+
+///@brief Expects @a expr to be false; see XM_EXPECT_TRUE().
+#define XM_EXPECT_FALSE(expr) xm::detail::Assert::True(!(expr), "!(" #expr ")", xm::detail::RecordFailure)
+
+///@brief Expects @a a and @a b to be equal; see XM_EXPECT_TRUE().
+#define XM_EXPECT_EQ(a, b) xm::detail::Assert::Equal((a), (b), #a, #b, xm::detail::RecordFailure)
+
+///@brief Expects @a a to be less than @a b; see XM_EXPECT_TRUE().
+#define XM_EXPECT_LT(a, b) xm::detail::Assert::LessThan((a), (b), #a, #b, xm::detail::RecordFailure)
+
+///@brief Expects @a a to be less than or equal to @a b; see XM_EXPECT_TRUE().
+#define XM_EXPECT_LE(a, b) xm::detail::Assert::LessEqual((a), (b), #a, #b, xm::detail::RecordFailure)
+
+///@brief Expects @a a to be greater than @a b; see XM_EXPECT_TRUE().
+#define XM_EXPECT_GT(a, b) xm::detail::Assert::GreaterThan((a), (b), #a, #b, xm::detail::RecordFailure)
+
+///@brief Expects @a a to be greater than or equal to @a b; see XM_EXPECT_TRUE().
+#define XM_EXPECT_GE(a, b) xm::detail::Assert::GreaterEqual((a), (b), #a, #b, xm::detail::RecordFailure)
+
+///@brief Expects @a and @a b to not be equal; see XM_EXPECT_TRUE().
+#define XM_EXPECT_NE(a, b) xm::detail::Assert::NotEqual((a), (b), #a, #b, xm::detail::RecordFailure)
+
+///@brief Expects equality of floating point values @a a and @a b; see XM_EXPECT_TRUE().
+#define XM_EXPECT_FEQ(a, b, epsilon) XM_EXPECT_LT(xm::detail::Abs((a) - (b)), epsilon)
+
+///@brief Expects @a and @a b, explicitly handled as strings, to be equal; see XM_EXPECT_TRUE().
+#define XM_EXPECT_STREQ(a, b) xm::detail::Assert::Equal(xm::detail::StringWrap(a), xm::detail::StringWrap(b), #a, #b, xm::detail::RecordFailure)
+
+///@brief Expects ranges @a a and @a b to be equal; see XM_ASSERT_RANGE_EQ() and XM_EXPECT_TRUE().
+#define XM_EXPECT_RANGE_EQ(a, b) xm::detail::Assert::RangeEqual((a), (b), #a, #b, xm::detail::RecordFailure)
+
+///@brief Expects the @a size bytes of memory at @a a and @a b to be equal; see
+/// XM_ASSERT_MEM_EQ() and XM_EXPECT_TRUE().
+#define XM_EXPECT_MEM_EQ(a, b, size) xm::detail::Assert::MemEqual((a), (b), (size), #a, #b, xm::detail::RecordFailure)
 
 ///@brief Asserts @a expr to result in an exception of the given @a exception type being thrown.
+///@note Requires exceptions to be enabled.
 #define XM_ASSERT_THROW(expr, exception)\
   try {\
     expr;\
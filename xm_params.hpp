@@ -0,0 +1,246 @@
+#ifndef XM_PARAMS_HPP
+#define XM_PARAMS_HPP
+//==============================================================================
+//
+// eXaM - single source, public domain, C++ unit testing framework.
+//
+// Refer to http://unlicense.org/ for licensing information.
+//
+//==============================================================================
+// Opts in to parameterized and typed tests - XM_TEST_P() and XM_TYPED_TEST() -, with
+// the generators of their parameters. Include it only where they're used.
+#include "xm.hpp"
+#include <array>
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace xm
+{
+
+///@brief A generator of the integers from @a begin up to, but not including @a end,
+/// by @a step - produced as they're iterated over -, for XM_TEST_P().
+template <typename T>
+class Range
+{
+public:
+  static_assert(std::is_integral_v<T>);
+
+  Range(T begin, T end, T step = 1)
+  : mBegin(begin),
+    mStep(step),
+    mSize(step > 0 && end > begin ? size_t((end - begin + step - 1) / step) :
+      step < 0 && end < begin ? size_t((begin - end - step - 1) / -step) : 0)
+  {}
+
+  class Iterator
+  {
+  public:
+    T operator*() const { return T(mRange->mBegin + T(mIndex) * mRange->mStep); }
+    Iterator& operator++() { ++mIndex; return *this; }
+    bool operator!=(Iterator const& other) const { return mIndex != other.mIndex; }
+
+  private:
+    Range const* mRange;
+    size_t mIndex;
+
+    Iterator(Range const* range, size_t index) : mRange(range), mIndex(index) {}
+
+    friend class Range;
+  };
+
+  Iterator begin() const { return Iterator(this, 0); }
+  Iterator end() const { return Iterator(this, mSize); }
+
+private:
+  T mBegin;
+  T mStep;
+  size_t mSize;
+};
+
+///@brief A generator of the given values, for XM_TEST_P().
+template <typename T, typename... Ts>
+constexpr std::array<T, 1 + sizeof...(Ts)> Values(T first, Ts... rest)
+{
+  return { first, T(rest)... };
+}
+
+namespace detail
+{
+
+// A test with a name of its own, which isn't registered; see TestGroup.
+class TestInstance : private std::string, public Test
+{
+public:
+  TestInstance(char const* suite, std::string name)
+  : std::string(std::move(name)),
+    Test(suite, c_str())
+  {}
+
+  ~TestInstance() override = default;
+};
+
+// Stands for a group of tests that it creates once it's first asked for them, named
+// after it with the index of the instance appended, e.g. Name/3.
+class TestGroup : public Test
+{
+protected:
+  TestGroup(char const* suite, char const* name)
+  : Test(suite, name),
+    mSuite(suite),
+    mName(name)
+  {}
+
+  virtual void Expand() =0;
+
+  void Add(TestInstance* instance)
+  {
+    mInstances.emplace_back(instance);
+  }
+
+  std::string MakeName(size_t i) const
+  {
+    return std::string(mName).append(1, '/').append(std::to_string(i));
+  }
+
+  char const* const mSuite;
+  char const* const mName;
+
+private:
+  std::vector<std::unique_ptr<TestInstance>> mInstances;
+  bool mExpanded = false;
+
+  size_t GetNumInstances() override
+  {
+    if (!mExpanded)
+    {
+      mExpanded = true;
+      Expand();
+    }
+    return mInstances.size();
+  }
+
+  Test& GetInstance(size_t i) override
+  {
+    return *mInstances[i];
+  }
+
+  void RunInternal() override
+  {}
+};
+
+// A test for each of the parameters that T::Params() generates; see XM_TEST_P().
+template <class T>
+class ParamTest : public TestGroup
+{
+public:
+  ParamTest(char const* suite, char const* name)
+  : TestGroup(suite, name)
+  {}
+
+private:
+  using Param = typename T::Param;
+
+  class Instance : public TestInstance
+  {
+  public:
+    Instance(char const* suite, std::string name, Param const& param)
+    : TestInstance(suite, std::move(name)),
+      mParam(param)
+    {}
+
+  protected:
+    void RunInternal() override
+    {
+      T::RunItAlready(mParam);
+    }
+
+  private:
+    Param mParam;
+  };
+
+  void Expand() override
+  {
+    size_t i = 0;
+    for (auto const& param : T::Params())
+    {
+      Add(new Instance(mSuite, MakeName(i), param));
+      ++i;
+    }
+  }
+};
+
+// A test for each of the types Ts; see XM_TYPED_TEST().
+template <class T, typename... Ts>
+class TypedTest : public TestGroup
+{
+public:
+  TypedTest(char const* suite, char const* name)
+  : TestGroup(suite, name)
+  {}
+
+private:
+  template <typename U>
+  class Instance : public TestInstance
+  {
+  public:
+    using TestInstance::TestInstance;
+
+  protected:
+    void RunInternal() override
+    {
+      T::template RunItAlready<U>();
+    }
+  };
+
+  void Expand() override
+  {
+    size_t i = 0;
+    (Add(new Instance<Ts>(mSuite, MakeName(i++))), ...);
+  }
+};
+
+} // detail
+
+} // xm
+
+///@brief Use this to declare and define a test for each of the parameters that the
+/// generator produces, which is accessible as @e param. The generator may be any
+/// expression that can be iterated over, e.g. a container, xm::Values() or xm::Range();
+/// it's only evaluated when RunTests() is first called. The tests are named after
+/// the index of their parameter, e.g. Suite_Name/3, which SetFilter() can select. e.g.:<br/>
+/// XM_TEST_P(Codec, RoundTrip, xm::Range(0, 256)) {<br/>
+///   XM_ASSERT_EQ(Decode(Encode(param)), param);<br/>
+/// }
+#define XM_TEST_P(suite, name, ...) static auto XM_DETAIL_TEST_NAME(suite, name ## Params)()\
+  {\
+    return __VA_ARGS__;\
+  }\
+  struct XM_DETAIL_TEST_CLASS_NAME(suite, name)\
+  {\
+    static auto Params() { return XM_DETAIL_TEST_NAME(suite, name ## Params)(); }\
+    using Param = std::decay_t<decltype(*std::begin(XM_DETAIL_TEST_NAME(suite, name ## Params)()))>;\
+    static void RunItAlready(Param const& param);\
+    XM_DETAIL_CREATE(xm::detail::ParamTest<XM_DETAIL_TEST_CLASS_NAME(suite, name)>, (#suite, #name))\
+  };\
+  XM_DETAIL_REGISTER(suite, name, XM_DETAIL_TEST_CLASS_NAME(suite, name)::Create, true);\
+  void XM_DETAIL_TEST_CLASS_NAME(suite, name) ::RunItAlready([[maybe_unused]] Param const& param)
+
+///@brief Use this to declare and define a test for each of the types that follow
+/// @a name, which is accessible as @e TypeParam. The tests are named after the index
+/// of their type, e.g. Suite_Name/1. e.g.:<br/>
+/// XM_TYPED_TEST(Containers, StartEmpty, std::vector<int>, std::deque<int>) {<br/>
+///   XM_ASSERT_TRUE(TypeParam().empty());<br/>
+/// }
+#define XM_TYPED_TEST(suite, name, ...) struct XM_DETAIL_TEST_CLASS_NAME(suite, name)\
+  {\
+    template <typename TypeParam>\
+    static void RunItAlready();\
+    XM_DETAIL_CREATE(XM_DETAIL_TEST_CLASS_NAME(suite, name) ::Group, (#suite, #name))\
+    using Group = xm::detail::TypedTest<XM_DETAIL_TEST_CLASS_NAME(suite, name), __VA_ARGS__>;\
+  };\
+  XM_DETAIL_REGISTER(suite, name, XM_DETAIL_TEST_CLASS_NAME(suite, name)::Create, true);\
+  template <typename TypeParam>\
+  void XM_DETAIL_TEST_CLASS_NAME(suite, name) ::RunItAlready()
+
+#endif  //XM_PARAMS_HPP
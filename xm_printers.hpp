@@ -0,0 +1,31 @@
+#ifndef XM_PRINTERS_HPP
+#define XM_PRINTERS_HPP
+//==============================================================================
+//
+// eXaM - single source, public domain, C++ unit testing framework.
+//
+// Refer to http://unlicense.org/ for licensing information.
+//
+//==============================================================================
+// Opts in to printing values by their operator<< in the messages of failed
+// assertions. This costs an #include <ostream> (which xm.hpp avoids) in every
+// file that includes it, so include it only where it's wanted.
+#include "xm.hpp"
+#include <ostream>
+#include <utility>
+
+namespace xm
+{
+
+template <typename T>
+struct ValuePrinter<T, std::void_t<decltype(std::declval<std::ostream&>() << std::declval<T const&>())>>
+{
+  static void Print(T const& value, std::ostream& os)
+  {
+    os << value;
+  }
+};
+
+} // xm
+
+#endif  //XM_PRINTERS_HPP
@@ -0,0 +1,479 @@
+#ifndef XM_PROPERTY_HPP
+#define XM_PROPERTY_HPP
+//==============================================================================
+//
+// eXaM - single source, public domain, C++ unit testing framework.
+//
+// Refer to http://unlicense.org/ for licensing information.
+//
+//==============================================================================
+// Opts in to property-based tests - XM_PROPERTY() -, with the generators of their
+// arguments (see xm::gen). Include it only where they're used.
+#include "xm.hpp"
+#include <string>
+#include <vector>
+#include <tuple>
+#include <limits>
+#include <cmath>
+
+namespace xm
+{
+
+///@brief Generators of the arguments of XM_PROPERTY() tests. A generator provides
+/// the type of its values, as Value, and the const member functions Value
+/// operator()(Rng&), and std::vector<Value> Shrink(Value const&), which offers
+/// simpler values to try in place of a failing one - simplest first -, or none if the
+/// value is as simple as it gets.
+namespace gen
+{
+
+namespace detail
+{
+
+// Offers the removal of elements from the sequence @a value first, then the simpler
+// versions of its elements that @a shrink offers.
+template <typename T, typename ShrinkFn>
+std::vector<T> ShrinkSequence(T const& value, ShrinkFn shrink)
+{
+  constexpr size_t kMaxPositions = 32;  // to try shrinking, at the front of the sequence.
+  std::vector<T> candidates;
+  auto size = value.size();
+  auto numPositions = size < kMaxPositions ? size : kMaxPositions;
+  if (size > 0)
+  {
+    candidates.emplace_back();
+    auto half = size / 2;
+    if (half > 0)
+    {
+      candidates.emplace_back(value.begin(), value.begin() + half);
+      candidates.emplace_back(value.end() - half, value.end());
+    }
+
+    for (size_t i = 0; i < numPositions; ++i)
+    {
+      candidates.push_back(value);
+      candidates.back().erase(candidates.back().begin() + i);
+    }
+  }
+
+  for (size_t i = 0; i < numPositions; ++i)
+  {
+    for (auto& element : shrink(value[i]))
+    {
+      candidates.push_back(value);
+      candidates.back()[i] = std::move(element);
+    }
+  }
+  return candidates;
+}
+
+}
+
+///@brief Integers in the range [ @a min, @a max ], shrinking towards 0 - or the
+/// bound closest to it. The bounds and 0 are generated more often than others.
+template <typename T>
+class Int
+{
+public:
+  static_assert(std::is_integral_v<T>);
+
+  using Value = T;
+
+  Int(T min = std::numeric_limits<T>::min(), T max = std::numeric_limits<T>::max())
+  : mMin(min),
+    mMax(max)
+  {}
+
+  T operator()(Rng& rng) const
+  {
+    if (rng.Below(8) == 0)
+    {
+      T const specials[]{ mMin, mMax, Target() };
+      return specials[rng.Below(3)];
+    }
+    return T(uint64_t(mMin) + rng.Below(uint64_t(mMax) - uint64_t(mMin) + 1));
+  }
+
+  std::vector<T> Shrink(T const& value) const
+  {
+    // The target, then halfway there, and so on, narrowing down on the value.
+    std::vector<T> candidates;
+    auto target = Target();
+    auto distance = value > target ? uint64_t(value) - uint64_t(target) :
+      uint64_t(target) - uint64_t(value);
+    for (; distance > 0; distance /= 2)
+    {
+      candidates.push_back(value > target ? T(uint64_t(value) - distance) :
+        T(uint64_t(value) + distance));
+    }
+    return candidates;
+  }
+
+private:
+  T mMin;
+  T mMax;
+
+  T Target() const
+  {
+    return mMin > T(0) ? mMin : mMax < T(0) ? mMax : T(0);
+  }
+};
+
+///@brief Floating point numbers in the range [ @a min, @a max ], shrinking towards
+/// 0 - or the bound closest to it -, and whole numbers. The bounds and 0 are generated
+/// more often than others.
+template <typename T>
+class Float
+{
+public:
+  static_assert(std::is_floating_point_v<T>);
+
+  using Value = T;
+
+  Float(T min = T(-1e6), T max = T(1e6))
+  : mMin(min),
+    mMax(max)
+  {}
+
+  T operator()(Rng& rng) const
+  {
+    if (rng.Below(8) == 0)
+    {
+      T const specials[]{ mMin, mMax, Target() };
+      return specials[rng.Below(3)];
+    }
+    auto value = T(mMin + (mMax - mMin) * rng.Unit());
+    return value < mMax ? value : mMax;
+  }
+
+  std::vector<T> Shrink(T const& value) const
+  {
+    std::vector<T> candidates;
+    auto target = Target();
+    if (value != target)
+    {
+      candidates.push_back(target);
+      auto whole = std::trunc(value);
+      if (whole != value)
+      {
+        if (whole >= mMin && whole <= mMax)
+        {
+          candidates.push_back(whole);
+        }
+      }
+      else
+      {
+        // Halfway to the target, and so on, narrowing down on the value.
+        for (auto distance = std::trunc((value - target) / 2); std::abs(distance) >= T(1);
+          distance = std::trunc(distance / 2))
+        {
+          candidates.push_back(value - distance);
+        }
+      }
+    }
+    return candidates;
+  }
+
+private:
+  T mMin;
+  T mMax;
+
+  T Target() const
+  {
+    return mMin > T(0) ? mMin : mMax < T(0) ? mMax : T(0);
+  }
+};
+
+///@brief Strings of up to @a maxSize characters in the range [ @a minChar, @a maxChar ]
+/// (printable ASCII by default), shrinking towards fewer characters, and ones
+/// closer to @a minChar.
+class String
+{
+public:
+  using Value = std::string;
+
+  explicit String(size_t maxSize = 32, char minChar = ' ', char maxChar = '~')
+  : mMaxSize(maxSize),
+    mChars(minChar, maxChar)
+  {}
+
+  std::string operator()(Rng& rng) const
+  {
+    std::string str(rng.Below(mMaxSize + 1), '\0');
+    for (auto& c : str)
+    {
+      c = mChars(rng);
+    }
+    return str;
+  }
+
+  std::vector<std::string> Shrink(std::string const& value) const
+  {
+    return detail::ShrinkSequence(value, [this](char c) { return mChars.Shrink(c); });
+  }
+
+private:
+  size_t mMaxSize;
+  Int<char> mChars;
+};
+
+///@brief std::vectors of up to @a maxSize values of @a element, shrinking towards
+/// fewer elements, and simpler ones.
+template <class G>
+class Vector
+{
+public:
+  using Value = std::vector<typename G::Value>;
+
+  explicit Vector(G element, size_t maxSize = 32)
+  : mElement(std::move(element)),
+    mMaxSize(maxSize)
+  {}
+
+  Value operator()(Rng& rng) const
+  {
+    Value values;
+    auto size = rng.Below(mMaxSize + 1);
+    values.reserve(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+      values.push_back(mElement(rng));
+    }
+    return values;
+  }
+
+  std::vector<Value> Shrink(Value const& value) const
+  {
+    return detail::ShrinkSequence(value, [this](typename G::Value const& e) {
+      return mElement.Shrink(e);
+    });
+  }
+
+private:
+  G mElement;
+  size_t mMaxSize;
+};
+
+}
+
+namespace detail
+{
+
+// Appends @a value to @a out, as failure messages show it.
+void AppendPrintable(Printable const& value, std::string& out);
+
+template <typename T, typename = void>
+struct IsListable : std::false_type {};
+
+template <typename T>
+struct IsListable<T, std::void_t<decltype(std::begin(std::declval<T const&>()))>> :
+  std::bool_constant<!std::is_convertible_v<T, StringWrap>> {};
+
+// Appends the argument of a property, @a value, to @a out, with the elements of
+// containers (other than strings) listed.
+template <typename T>
+void PrintArgument(T const& value, std::string& out)
+{
+  if constexpr (IsListable<T>::value)
+  {
+    constexpr size_t kMaxElements = 32;
+    size_t i = 0;
+    out.append("{");
+    for (auto const& element : value)
+    {
+      out.append(i > 0 ? ", " : " ");
+      if (i == kMaxElements)
+      {
+        out.append("...");
+        break;
+      }
+      PrintArgument(element, out);
+      ++i;
+    }
+    out.append(i > 0 ? " }" : "}");
+  }
+  else
+  {
+    AppendPrintable(MakePrintable<T, T>(value), out);
+  }
+}
+
+// Runs @a fn with @a context, as a case of a property: failures are caught and their
+// message copied into @a error, rather than failing the test.
+///@return Whether the case has passed.
+bool CheckCase(void (*fn)(void const* context), void const* context, std::string& error);
+
+using CheckFn = bool(*)(void const* context, uint64_t seed, std::string& error);
+
+// The outcome of checking a property.
+struct PropertyCheck
+{
+  uint64_t runSeed; // to reproduce the run, see SetPropertySeed().
+  size_t numCases;
+  size_t failedCase;  // the index of the first to fail, or numCases if none has.
+  uint64_t failedSeed;  // that the failed case was generated from.
+  std::string error;
+};
+
+// Generates the cases of the property @a suite, @a name, and checks them with @a check
+// and @a context, on the threads that SetPropertyThreads() allows. Cases are checked
+// in order on each thread, and outcome is that of the first that fails, regardless
+// of the number of threads.
+void CheckProperty(char const* suite, char const* name, CheckFn check, void const* context,
+  PropertyCheck& result);
+
+// Fails the property with the counterexample, @a arguments, which it was shrunk to in
+// @a numShrinks steps.
+void FailProperty(PropertyCheck const& result, char const* arguments, size_t numShrinks);
+
+template <typename Generators>
+struct PropertyArgs;
+
+template <typename... Gs>
+struct PropertyArgs<std::tuple<Gs...>>
+{
+  using Type = std::tuple<typename Gs::Value...>;
+};
+
+// Checks T::RunItAlready() with the arguments that T::Generators() produce; see
+// XM_PROPERTY().
+template <class T>
+class Property : public Test
+{
+public:
+  Property(char const* suite, char const* name)
+  : Test(suite, name),
+    mSuite(suite),
+    mName(name)
+  {}
+
+protected:
+  void RunInternal() override
+  {
+    auto generators = T::MakeGenerators();
+    PropertyCheck result;
+    CheckProperty(mSuite, mName, Check, &generators, result);
+    if (result.failedCase == result.numCases)
+    {
+      return;
+    }
+
+    auto args = Generate(generators, result.failedSeed);
+    auto numShrinks = Shrink(generators, args, result.error);
+
+    AllocationPause pause;
+    std::string arguments("(");
+    std::apply([&arguments](auto const&... arg) {
+      size_t i = 0;
+      ((arguments.append(i++ > 0 ? ", " : ""), PrintArgument(arg, arguments)), ...);
+    }, args);
+    arguments.append(")");
+    FailProperty(result, arguments.c_str(), numShrinks);
+  }
+
+private:
+  using Generators = typename T::Generators;
+  using Args = typename T::Args;
+
+  static constexpr size_t kMaxShrinkAttempts = 1000;
+
+  char const* const mSuite;
+  char const* const mName;
+
+  static Args Generate(Generators const& generators, uint64_t seed)
+  {
+    Rng rng(seed);
+    return std::apply([&rng](auto const&... g) {
+      return Args{ g(rng)... }; // braced initialization is evaluated in order.
+    }, generators);
+  }
+
+  static void Run(void const* args)
+  {
+    T::RunItAlready(*static_cast<Args const*>(args));
+  }
+
+  static bool Check(void const* context, uint64_t seed, std::string& error)
+  {
+    auto args = Generate(*static_cast<Generators const*>(context), seed);
+    return CheckCase(Run, &args, error);
+  }
+
+  // Replaces @a args with the simplest variant that still fails, as far as the
+  // generators' shrinkers get, one argument at a time, within kMaxShrinkAttempts.
+  ///@return The number of steps that it took.
+  static size_t Shrink(Generators const& generators, Args& args, std::string& error)
+  {
+    size_t numShrinks = 0;
+    size_t numAttempts = 0;
+    std::string candidateError;
+    auto shrinkArgument = [&](auto index) {
+      constexpr size_t kIndex = decltype(index)::value;
+      for (auto& candidate : std::get<kIndex>(generators).Shrink(std::get<kIndex>(args)))
+      {
+        if (numAttempts++ == kMaxShrinkAttempts)
+        {
+          return false;
+        }
+
+        auto shrunk = args;
+        std::get<kIndex>(shrunk) = std::move(candidate);
+        candidateError.clear();
+        if (!CheckCase(Run, &shrunk, candidateError))
+        {
+          args = std::move(shrunk);
+          error.swap(candidateError);
+          ++numShrinks;
+          return true;
+        }
+      }
+      return false;
+    };
+
+    bool shrunk;
+    do
+    {
+      shrunk = ShrinkArguments(shrinkArgument,
+        std::make_index_sequence<std::tuple_size_v<Args>>());
+    }
+    while (shrunk && numAttempts < kMaxShrinkAttempts);
+    return numShrinks;
+  }
+
+  template <typename Fn, size_t... kIndices>
+  static bool ShrinkArguments(Fn& fn, std::index_sequence<kIndices...>)
+  {
+    return (fn(std::integral_constant<size_t, kIndices>()) || ...);
+  }
+};
+
+} // detail
+
+} // xm
+
+///@brief Use this to declare and define a property: a test that's checked with
+/// arguments produced by the given generators (see xm::gen), a number of times (see
+/// SetPropertyCases()). The arguments are accessible as the tuple @e args. Should a
+/// case fail, its arguments are shrunk to the simplest that still fail, which are
+/// reported, with the seed to reproduce them. The cases may be checked on multiple
+/// threads at once (see SetPropertyThreads()). e.g.:<br/>
+/// XM_PROPERTY(Codec, RoundTrip, xm::gen::String(), xm::gen::Int<int>(0, 9)) {<br/>
+///   auto const& [text, level] = args;<br/>
+///   XM_ASSERT_EQ(Decode(Encode(text, level)), text);<br/>
+/// }
+#define XM_PROPERTY(suite, name, ...) static auto XM_DETAIL_TEST_NAME(suite, name ## Generators)()\
+  {\
+    return std::make_tuple(__VA_ARGS__);\
+  }\
+  struct XM_DETAIL_TEST_CLASS_NAME(suite, name)\
+  {\
+    using Generators = decltype(XM_DETAIL_TEST_NAME(suite, name ## Generators)());\
+    using Args = typename xm::detail::PropertyArgs<Generators>::Type;\
+    static Generators MakeGenerators() { return XM_DETAIL_TEST_NAME(suite, name ## Generators)(); }\
+    static void RunItAlready(Args const& args);\
+    XM_DETAIL_CREATE(xm::detail::Property<XM_DETAIL_TEST_CLASS_NAME(suite, name)>, (#suite, #name))\
+  };\
+  XM_DETAIL_REGISTER(suite, name, XM_DETAIL_TEST_CLASS_NAME(suite, name)::Create, false);\
+  void XM_DETAIL_TEST_CLASS_NAME(suite, name) ::RunItAlready([[maybe_unused]] Args const& args)
+
+#endif  //XM_PROPERTY_HPP
@@ -0,0 +1,72 @@
+#ifndef XM_THREADS_HPP
+#define XM_THREADS_HPP
+//==============================================================================
+//
+// eXaM - single source, public domain, C++ unit testing framework.
+//
+// Refer to http://unlicense.org/ for licensing information.
+//
+//==============================================================================
+// Opts in to making assertions on threads other than that of the test - see
+// xm::ThreadGuard and xm::Spawn(). Include it only where they're used.
+#include "xm.hpp"
+#include <thread>
+#include <tuple>
+
+namespace xm
+{
+
+namespace detail
+{
+
+class TestContext;
+
+// Calls @a fn with @a context on this thread, as part of the test that @a testContext
+// belongs to; see ThreadGuard.
+void RunInContext(TestContext* testContext, void (*fn)(void const* context),
+  void const* context);
+
+} // detail
+
+///@brief Carries the test that it's created by - on the thread of the test - over
+/// to other threads, so that the assertions made on them count towards the test:
+/// failures are recorded into it, and fail it once it has finished. The threads must
+/// be done with it before the test returns. e.g.:<br/>
+/// xm::ThreadGuard guard;<br/>
+/// pool.Submit([&guard] { guard.Run([] { XM_ASSERT_TRUE(Invariant()); }); });
+///@note A failed assertion outside of a test and a ThreadGuard - where no one would
+/// catch it - aborts the process.
+class ThreadGuard
+{
+public:
+  ThreadGuard();
+
+  ///@brief Calls @a fn on this thread, as part of the test. A failed assertion ends
+  /// @a fn, not the test.
+  template <typename Fn>
+  void Run(Fn&& fn) const
+  {
+    detail::RunInContext(mContext, [](void const* context) {
+      (*static_cast<std::remove_reference_t<Fn>*>(const_cast<void*>(context)))();
+    }, &fn);
+  }
+
+private:
+  detail::TestContext* mContext;
+};
+
+///@brief Starts a thread that calls @a fn with @a args, as part of the current test;
+/// see ThreadGuard.
+template <typename Fn, typename... Args>
+std::thread Spawn(Fn&& fn, Args&&... args)
+{
+  detail::AllocationPause pause;  // the thread's state is freed by the thread.
+  return std::thread([guard = ThreadGuard(), fn = std::forward<Fn>(fn),
+    args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+    guard.Run([&fn, &args]() { std::apply(fn, std::move(args)); });
+  });
+}
+
+} // xm
+
+#endif  //XM_THREADS_HPP